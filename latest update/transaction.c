@@ -1,23 +1,216 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#define fsync _commit
+#else
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
 
-#define MAX_ACCOUNTS 100
+#define ACCOUNT_PAGE 256           // accounts are allocated in pages of this many slots
+#define ACCOUNT_DELETED -1         // isActive of a deleted slot (tombstone) awaiting reuse
+#define COMPACT_TOMBSTONE_SHARE 4  // compact once 1/4 of the used slots are tombstones
+#define DB_MAGIC 0x4B4E4142       // "BANK"; legacy files start with the account count
+#define DB_VERSION 3                    // 3: balances in cents; older files hold doubles
+#define JOURNAL_FILE "accounts.jnl"
+#define JOURNAL_SYNC_EVERY 8            // group fsync: one fsync per this many appends
+#define JOURNAL_CHECKPOINT_EVERY 1024   // fold the journal into accounts.dat this often
 #define NAME_LENGTH 50
 #define PIN_LENGTH 5
+#define MONEY_SCALE 100                  // Money is in cents
+#define MONEY_LIMIT 900000000000000000LL // largest magnitude accepted, in cents
+#define ACCOUNT_LOCK_STRIPES 1024        // transfer locks, by account slot
+#define TRANSFER_THREADS_MAX 64
+#define TRANSFER_CLAIM 256               // batch transfers a worker takes at a time
+#define RECEIPT_LOG "receipts.log"
+#define RECEIPT_LOG_LIMIT (16L * 1024 * 1024) // rotate the receipt log past this size
+#define RECEIPT_LOG_KEEP 4                    // rotated logs kept: receipts.log.1 .. .4
+#define IMPORT_BUFFER (1024 * 1024)           // read buffer for bulk account imports
+#define METRIC_LINEAR 16                      // latency histogram: exact below 16 ns,
+#define METRIC_SUB_BUCKETS 8                  // then 8 buckets per power of two
+#define METRIC_BUCKETS (METRIC_LINEAR + (64 - 4) * METRIC_SUB_BUCKETS)
+#define METRIC_UNTIMED -1LL
+// Metric counters: relaxed atomics between threads, plain accesses without
+#ifndef _WIN32
+#define METRIC_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define METRIC_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#else
+#define METRIC_STORE(field, value) ((field) = (value))
+#define METRIC_LOAD(field) (field)
+#endif
+
+// Exact amount in minor units (cents); doubles are only used for input and display
+typedef long long Money;
 
 typedef struct {
     int accountNumber;
     char firstName[NAME_LENGTH];
     char lastName[NAME_LENGTH];
-    double balance;
+    Money balance;
     char pin[PIN_LENGTH];
     int isActive;
 } Account;
 
-static Account accounts[MAX_ACCOUNTS];
-static int totalAccounts = 0;
+// accounts.dat header; the file then holds `capacity` slots: the accounts
+// rounded up to whole pages
+typedef struct {
+    int magic;
+    int version;
+    int count;
+    int capacity;
+    long long checkpointLsn;   // last journal entry folded into this file (version 2+)
+} DatabaseHeader;
+
+// Journal entry types
+enum { JOURNAL_CREATE = 1, JOURNAL_BALANCE, JOURNAL_STATUS, JOURNAL_DELETE, JOURNAL_TRANSFER };
+
+// One append to accounts.jnl; JOURNAL_CREATE entries are followed by the Account
+typedef struct {
+    unsigned int checksum;     // FNV-1a over the rest of the entry and its payload
+    int type;
+    long long lsn;
+    int accountNumber;
+    int payloadSize;
+    long long value;           // balance delta in cents, new isActive for JOURNAL_STATUS,
+                               // or the amount moved for JOURNAL_TRANSFER
+} JournalEntry;
+
+// Payload of a JOURNAL_TRANSFER entry, whose accountNumber is the debited
+// account: both sides of a transfer are one record, so replay applies both or neither
+typedef struct {
+    int toAccount;
+    int reserved;
+} TransferPayload;
+
+// A JOURNAL_TRANSFER entry and its payload, as batch transfers hold them
+typedef struct {
+    JournalEntry entry;
+    TransferPayload transfer;
+} TransferRecord;
+
+// One line of receipts.log (tab-separated). The id is the journal LSN of
+// the transaction, so it is unique; both sides of a transfer share it.
+typedef struct {
+    long long id;
+    long long time;            // seconds since the epoch
+    int accountNumber;
+    char type[16];
+    Money amount;
+    Money balance;
+} Receipt;
+
+// One line of a batch transfer file, resolved to slots
+typedef struct {
+    int from, to;              // slots in accounts[]
+    Money amount;
+} PendingTransfer;
+
+// Results of the bank* operations. They take every input as an argument
+// and never prompt or print; the menu handlers are thin callers. --import
+// and batch transfers check rows by the same rules (checkNewAccount, the
+// bankTransfer checks) but apply them through appendAccount and
+// transferBetween directly, so a whole file costs one checkpoint or one
+// journal sync instead of one per row.
+enum {
+    BANK_OK,
+    BANK_NOT_FOUND,
+    BANK_EXISTS,           // account number already in use
+    BANK_INACTIVE,         // the account (or the receiving one) is deactivated
+    BANK_SAME_ACCOUNT,     // transfer to the account it comes from
+    BANK_BAD_AMOUNT,       // amount not above zero, or opening balance below it
+    BANK_INSUFFICIENT,     // balance does not cover the withdrawal or transfer
+    BANK_LIMIT,            // the receiving balance would pass MONEY_LIMIT
+    BANK_BAD_PIN,
+    BANK_INVALID,          // account number not above zero, PIN not 4 digits, or status not 0/1
+    BANK_NO_MEMORY,
+    BANK_NOT_SAVED         // applied in memory, but neither journaled nor checkpointed
+};
+
+// Shared state of a batch transfer run
+typedef struct {
+    PendingTransfer *transfers;
+    int count;
+    int next;                  // next transfer to claim
+    int applied, insufficient;
+} TransferBatch;
+
+// Hot-path metrics, dumped as one JSON line to stderr on SIGUSR1. Each
+// thread counts into a block of its own (relaxed atomic stores, no lock);
+// the dump adds the blocks up.
+enum {
+    METRIC_LOOKUP,             // findAccountByNumber; a hit finds the account (count only)
+    METRIC_DEPOSIT,
+    METRIC_WITHDRAW,
+    METRIC_TRANSFER,           // transferBetween, menu and batch
+    METRIC_JOURNAL,            // journalWrite
+    METRIC_FSYNC,              // journalSync
+    METRIC_CHECKPOINT,         // writeCheckpoint
+    METRIC_OPS
+};
+
+typedef struct {
+    unsigned long long count, bytes, hits, timed, totalNanos, maxNanos;
+    unsigned long long buckets[METRIC_BUCKETS];
+} MetricCounters;
+
+typedef struct MetricsBlock {
+    MetricCounters ops[METRIC_OPS];
+    struct MetricsBlock *next;
+    int inUse;                 // guarded by metricsLock
+} MetricsBlock;
+
+static Account *accounts = NULL;
+static int totalAccounts = 0;        // live accounts
+static int slotCount = 0;            // slots in use: live accounts plus tombstones
+static int accountCapacity = 0;
+
+// Tombstoned slots, reused by createAccount before accounts[] grows (a stack)
+static int *freeSlots = NULL;
+static int freeCount = 0;
+static int freeCapacity = 0;
+
+// Open-addressing (linear probing) index: accountNumber -> slot in accounts[]
+#define INDEX_EMPTY -1
+static int *accountIndex = NULL;
+static int indexCapacity = 0;     // power of two, at least twice totalAccounts
+
+// Cached sorted views: permutations of slots in accounts[], rebuilt lazily
+enum { SORT_BY_NUMBER, SORT_BY_FIRST_NAME, SORT_BY_BALANCE, SORT_KEYS };
+static int *sortedView[SORT_KEYS];
+static int sortedViewValid[SORT_KEYS];
+
+static FILE *journal = NULL;
+static long long journalLsn = 0;      // last LSN appended or replayed
+static long long checkpointLsn = 0;   // last LSN reflected in accounts.dat
+static int journalUnsynced = 0;
+static int journalTorn = 0;           // a failed write may have left part of an entry: append nothing more
+static int legacyBalances = 0;        // accounts.dat/journal predate Money (doubles on disk)
+static int journalBatching = 0;       // batch running: defer fsync and checkpoints to its end
+static TransferRecord *batchJournal = NULL; // batch transfers, at [lsn - batchFirstLsn]
+static long long batchFirstLsn = 0;
+static FILE *receiptLog = NULL;       // flushed after every receipt, synced with the journal
+static long receiptLogSize = 0;
+
+#ifndef _WIN32
+// Transfers lock both accounts' stripes in ascending order, so concurrent
+// transfers in opposite directions cannot deadlock
+static pthread_mutex_t accountLocks[ACCOUNT_LOCK_STRIPES];
+static pthread_mutex_t journalLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t batchLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static MetricsBlock *metricsBlocks = NULL;
+static long long metricsStarted = 0;
+#ifndef _WIN32
+static pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t metricsKey;     // releases a finished worker's block for reuse
+static __thread MetricsBlock *metricsMine = NULL;
+#endif
 
 // Prototypes
 void loadAccounts(void);
@@ -29,10 +222,67 @@ void sortAccounts(void);
 void processTransaction(void);
 void deactivateOrDeleteAccount(void);
 void activateAccount(void);
+void transferFunds(void);
+void batchTransfers(void);
+int importAccounts(const char*);
 int authenticateUser(const int);
-void generateReceipt(const Account*, const char*, double, double);
+void generateReceipt(const Account*, const char*, Money, Money);
 void showTransactionConfirmation(const int, const char*);
 int findAccountByNumber(const int);
+const Account *bankAccount(int);
+int bankCreateAccount(const Account*);
+int bankDeposit(int, Money);
+int bankWithdraw(int, Money);
+int bankTransfer(int, int, Money);
+int bankSetActive(int, int);
+int bankDeleteAccount(int);
+int bankCheckPin(int, const char*);
+int bankSearch(const char*, void (*)(const Account*, void*), void*);
+static int reserveAccounts(int);
+static void rebuildIndex(void);
+static void indexInsert(int);
+static void indexRemove(int);
+static int appendAccount(const Account*);
+static int checkNewAccount(const Account*);
+static int warnIfNotSaved(int);
+static void reportBalanceStatus(int, const Account*);
+static void removeAccountAt(int);
+static void compactAccounts(void);
+static void compactIfSparse(void);
+static int writeCheckpoint(void);
+static void replayJournal(void);
+static int journalAppend(int, const Account*, long long);
+static int journalWrite(int, int, long long, const void*, int);
+static int journalFailed(void);
+static int journalSync(void);
+static unsigned int journalChecksum(const JournalEntry*, const void*);
+static int transferBetween(int, int, Money);
+static void lockAccountPair(int, int);
+static void unlockAccountPair(int, int);
+static void *transferWorker(void*);
+static int transferThreadCount(int);
+static void printReceipt(FILE*, const Receipt*);
+static void rotateReceiptLog(void);
+static void closeReceiptLog(void);
+static int showReceipts(long long, int);
+static void printAccounts(const int*);
+static const int *getSortedView(int);
+static void invalidateSortedViews(void);
+static int applyBalanceDelta(int, Money);
+static int moneyFromDouble(double, Money*);
+static double moneyToDouble(Money);
+static Money moneyFromStoredDouble(long long);
+static int moneyAdd(Money*, Money);
+static void metricsStart(void);
+static long long metricsNow(void);
+static void metricsRecord(int, long long, size_t, int);
+static void metricsDump(FILE*);
+
+// Drop trailing blanks from a string in place
+static void trimTrailingSpace(char *text) {
+    size_t length = strlen(text);
+    while (length > 0 && (text[length-1] == ' ' || text[length-1] == '\t')) text[--length] = '\0';
+}
 
 // Helper for string input
 static void inputString(const char *prompt, char *buffer, size_t len) {
@@ -42,10 +292,31 @@ static void inputString(const char *prompt, char *buffer, size_t len) {
     }
 }
 
-int main(void) {
+int main(int argc, char *argv[]) {
     int choice;
+    // Offline receipt lookup: transaction --receipt <id> | --receipts <account>
+    if (argc == 3 && strcmp(argv[1], "--receipt") == 0)
+        return showReceipts(atoll(argv[2]), 0) > 0 ? 0 : 1;
+    if (argc == 3 && strcmp(argv[1], "--receipts") == 0)
+        return showReceipts(0, atoi(argv[2])) > 0 ? 0 : 1;
+    metricsStart(); // kill -USR1 <pid> prints the metrics to stderr
+    // Bulk account creation: transaction --import <csv>
+    if (argc == 3 && strcmp(argv[1], "--import") == 0) {
+        loadAccounts();
+        int imported = importAccounts(argv[2]);
+        closeReceiptLog();
+        return imported < 0 ? 1 : 0;
+    }
+    if (argc != 1) {
+        printf("Usage: %s [--receipt <id> | --receipts <account> | --import <file>]\n", argv[0]);
+        return 1;
+    }
+#ifndef _WIN32
+    for (int i=0; i<ACCOUNT_LOCK_STRIPES; ++i) pthread_mutex_init(&accountLocks[i], NULL);
+#endif
     loadAccounts();
     while (1) {
+        compactIfSparse(); // between commands no slot or Account pointer is held
         printf("\n=== ENHANCED BANK TRANSACTION SYSTEM ===\n");
         printf("1. Create New Account\n");
         printf("2. Display All Accounts\n");
@@ -54,7 +325,9 @@ int main(void) {
         printf("5. Process Transaction\n");
         printf("6. Deactivate/Delete Account\n");
         printf("7. Activate Account\n");
-        printf("8. Exit\n");
+        printf("8. Transfer Between Accounts\n");
+        printf("9. Batch Transfers from File\n");
+        printf("10. Exit\n");
         printf("Enter your choice: ");
         if (scanf("%d", &choice) != 1) {
             while(getchar()!='\n');
@@ -69,40 +342,125 @@ int main(void) {
             case 5: processTransaction(); break;
             case 6: deactivateOrDeleteAccount(); break;
             case 7: activateAccount(); break;
-            case 8: saveAccounts(); puts("Thank you for using our banking system!"); exit(0);
+            case 8: transferFunds(); break;
+            case 9: batchTransfers(); break;
+            case 10: saveAccounts(); puts("Thank you for using our banking system!"); exit(0);
             default: puts("Invalid choice! Please try again.");
         }
     }
     return 0;
 }
 
+// Grow the account array to hold at least `needed` accounts, a page at a time
+static int reserveAccounts(int needed) {
+    if (needed <= accountCapacity) return 0;
+    int newCapacity = (needed + ACCOUNT_PAGE - 1) / ACCOUNT_PAGE * ACCOUNT_PAGE;
+    Account *grown = realloc(accounts, (size_t)newCapacity * sizeof(Account));
+    if (!grown) return -1;
+    memset(grown + accountCapacity, 0, (size_t)(newCapacity - accountCapacity) * sizeof(Account));
+    accounts = grown;
+    accountCapacity = newCapacity;
+    return 0;
+}
+
 void loadAccounts(void) {
     FILE *file = fopen("accounts.dat", "rb");
     if (file) {
-        fread(&totalAccounts, sizeof(int), 1, file);
-        fread(accounts, sizeof(Account), totalAccounts, file);
+        DatabaseHeader header = {0};
+        int count = 0;
+        if (fread(&header.magic, sizeof(int), 1, file) == 1) {
+            if (header.magic == DB_MAGIC) {
+                fread(&header.version, sizeof(int), 3, file);
+                if (header.version >= 2) fread(&header.checkpointLsn, sizeof(long long), 1, file);
+                count = header.count;
+            } else {
+                count = header.magic; // legacy file: bare account count
+            }
+        }
+        if (count < 0 || reserveAccounts(count) != 0) {
+            puts("Error loading database!");
+            count = 0;
+        }
+        slotCount = totalAccounts = (int)fread(accounts, sizeof(Account), count, file);
+        checkpointLsn = journalLsn = header.checkpointLsn;
         fclose(file);
+        if (header.magic != DB_MAGIC || header.version < 3) {
+            // Same layout with double balances: convert in memory; replay
+            // reads the old journal the same way, then a checkpoint is forced
+            legacyBalances = 1;
+            for (int i=0; i<totalAccounts; ++i)
+                accounts[i].balance = moneyFromStoredDouble(accounts[i].balance);
+        }
+        rebuildIndex();
+        invalidateSortedViews();
         printf("Loaded %d accounts from database.\n", totalAccounts);
     } else {
         puts("No existing database found. Starting fresh.");
-        totalAccounts = 0;
+        slotCount = totalAccounts = 0;
     }
+    replayJournal();
+    if (legacyBalances && writeCheckpoint() < 0) puts("Error converting database!");
 }
 
+// Checkpoint: fold every journaled change into accounts.dat, then start an
+// empty journal. Runs on exit and every JOURNAL_CHECKPOINT_EVERY appends.
 void saveAccounts(void) {
-    FILE *file = fopen("accounts.dat", "wb");
-    if (file) {
-        fwrite(&totalAccounts, sizeof(int), 1, file);
-        fwrite(accounts, sizeof(Account), totalAccounts, file);
-        fclose(file);
+    closeReceiptLog();
+    if (writeCheckpoint() >= 0)
         puts("Database saved successfully.");
-    } else
+    else
         puts("Error saving database!");
 }
 
+// Write accounts.dat via a temp file so a crash leaves either the old or
+// the new checkpoint, never a torn one; entries up to journalLsn are then
+// skipped by replay even if the journal truncation below never happens.
+// Tombstones are left out, so the file always holds the live accounts densely.
+// Returns -1 if accounts.dat was not replaced, 1 if it was but no new
+// journal could be opened.
+static int writeCheckpoint(void) {
+    static const Account blank[ACCOUNT_PAGE];
+    long long started = metricsNow();
+    // pad to whole pages of the live accounts, not to accountCapacity, which
+    // may have grown well past them (an import doubles it)
+    int capacity = (totalAccounts + ACCOUNT_PAGE - 1) / ACCOUNT_PAGE * ACCOUNT_PAGE;
+    FILE *file = fopen("accounts.dat.tmp", "wb");
+    if (!file) return -1;
+    DatabaseHeader header = {DB_MAGIC, DB_VERSION, totalAccounts, capacity, journalLsn};
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    for (int slot=0, run; slot<slotCount && !failed; slot+=run) {
+        for (run=0; slot+run<slotCount && accounts[slot+run].isActive != ACCOUNT_DELETED; ++run);
+        if (run == 0) { run = 1; continue; }
+        failed = fwrite(&accounts[slot], sizeof(Account), run, file) != (size_t)run;
+    }
+    for (int pad=capacity-totalAccounts; pad>0 && !failed; pad-=ACCOUNT_PAGE) {
+        size_t n = pad < ACCOUNT_PAGE ? (size_t)pad : ACCOUNT_PAGE;
+        failed = fwrite(blank, sizeof(Account), n, file) != n;
+    }
+    failed = failed || fflush(file) != 0 || fsync(fileno(file)) != 0;
+    long written = ftell(file);
+    if (fclose(file) != 0 || failed) {
+        remove("accounts.dat.tmp"); // never let a short checkpoint replace the old one
+        return -1;
+    }
+#ifdef _WIN32
+    remove("accounts.dat"); // rename() does not replace an existing file here
+#endif
+    if (rename("accounts.dat.tmp", "accounts.dat") != 0) return -1;
+    checkpointLsn = journalLsn;
+    legacyBalances = 0;
+
+    if (journal) fclose(journal);
+    journal = fopen(JOURNAL_FILE, "wb");
+    journalUnsynced = 0;
+    if (journal) journalTorn = 0;
+    metricsRecord(METRIC_CHECKPOINT, metricsNow() - started, written > 0 ? (size_t)written : 0, 0);
+    return journal ? 0 : 1;
+}
+
 void createAccount(void) {
-    if (totalAccounts >= MAX_ACCOUNTS) {
-        puts("Maximum account limit reached!");
+    if (freeCount == 0 && reserveAccounts(slotCount + 1) != 0) {
+        puts("Not enough memory for a new account!");
         return;
     }
     Account newAccount = {0};
@@ -113,7 +471,12 @@ void createAccount(void) {
         while(getchar()!='\n');
         puts("Enter a number for account number:");
     }
-    if (findAccountByNumber(newAccount.accountNumber)!=-1) {
+    if (newAccount.accountNumber <= 0) {
+        puts("Account number must be greater than 0!");
+        while(getchar()!='\n');
+        return;
+    }
+    if (bankAccount(newAccount.accountNumber)) {
         puts("Account number already exists!");
         while(getchar()!='\n');
         return;
@@ -123,19 +486,33 @@ void createAccount(void) {
     inputString("Enter last name: ", newAccount.lastName, NAME_LENGTH);
 
     printf("Enter initial balance: $");
-    while (scanf("%lf", &newAccount.balance)!=1 || newAccount.balance<0) {
+    double initialBalance;
+    while (scanf("%lf", &initialBalance)!=1 || initialBalance<0 ||
+           moneyFromDouble(initialBalance, &newAccount.balance)!=0) {
         while(getchar()!='\n');
         puts("Balance must be a positive number:");
     }
     while(getchar()!='\n');
     inputString("Set a 4-digit PIN: ", newAccount.pin, PIN_LENGTH);
-    newAccount.isActive = 1;
-    accounts[totalAccounts++] = newAccount;
+    int status = warnIfNotSaved(bankCreateAccount(&newAccount));
+    if (status == BANK_INVALID) {
+        puts("PIN must be 4 digits!");
+        return;
+    }
+    if (status != BANK_OK) {
+        puts("Not enough memory for a new account!");
+        return;
+    }
     puts("Account created successfully!");
-    saveAccounts();
 }
 
 void displayAllAccounts(void) {
+    printAccounts(NULL);
+}
+
+// Print every account, in slot order or following a sorted view
+static void printAccounts(const int *order) {
+    int shown = order ? totalAccounts : slotCount;
     if (totalAccounts == 0) {
         puts("No accounts found!");
         return;
@@ -143,16 +520,25 @@ void displayAllAccounts(void) {
     puts("\n=== ALL ACCOUNTS ===");
     printf("%-10s %-15s %-15s %-12s %-8s\n", "Acc No.", "First Name", "Last Name", "Balance", "Status");
     puts("----------------------------------------------------------------");
-    for (int i=0; i<totalAccounts; ++i)
+    for (int n=0; n<shown; ++n) {
+        const Account *acct = &accounts[order ? order[n] : n];
+        if (acct->isActive == ACCOUNT_DELETED) continue;
         printf("%-10d %-15s %-15s $%-11.2f %-8s\n",
-            accounts[i].accountNumber, accounts[i].firstName,
-            accounts[i].lastName, accounts[i].balance,
-            accounts[i].isActive?"Active":"Inactive");
+            acct->accountNumber, acct->firstName,
+            acct->lastName, moneyToDouble(acct->balance),
+            acct->isActive?"Active":"Inactive");
+    }
+}
+
+static void printSearchMatch(const Account *acct, void *context) {
+    (void)context;
+    printf("%-10d %-15s %-15s $%-11.2f\n",
+        acct->accountNumber, acct->firstName,
+        acct->lastName, moneyToDouble(acct->balance));
 }
 
 void searchByName(void) {
     char searchName[NAME_LENGTH];
-    int found=0;
     puts("\n=== SEARCH BY NAME ===");
     printf("Enter first or last name to search: ");
     while(getchar()!='\n');
@@ -161,15 +547,7 @@ void searchByName(void) {
     puts("\nSearch Results:");
     printf("%-10s %-15s %-15s %-12s\n", "Acc No.", "First Name", "Last Name", "Balance");
     puts("--------------------------------------------------------");
-    for (int i=0; i<totalAccounts; ++i) {
-        if (strstr(accounts[i].firstName, searchName) || strstr(accounts[i].lastName, searchName)) {
-            printf("%-10d %-15s %-15s $%-11.2f\n",
-                accounts[i].accountNumber, accounts[i].firstName,
-                accounts[i].lastName, accounts[i].balance);
-            found=1;
-        }
-    }
-    if (!found)
+    if (bankSearch(searchName, printSearchMatch, NULL) == 0)
         printf("No accounts found with name containing '%s'\n", searchName);
 }
 
@@ -184,54 +562,148 @@ void sortAccounts(void) {
     puts("3. Sort by Balance");
     printf("Enter sorting option: ");
     int choice=0; scanf("%d", &choice);
-    switch (choice) {
-        case 1:
-            for (int i=0; i<totalAccounts-1;++i)
-            for (int j=0;j<totalAccounts-1-i;++j)
-                if (accounts[j].accountNumber > accounts[j+1].accountNumber) {
-                    Account tmp = accounts[j]; accounts[j]=accounts[j+1]; accounts[j+1]=tmp;
-                }
-            break;
-        case 2:
-            for (int i=0; i<totalAccounts-1;++i)
-            for (int j=0;j<totalAccounts-1-i;++j)
-                if (strcmp(accounts[j].firstName, accounts[j+1].firstName)>0) {
-                    Account tmp = accounts[j]; accounts[j]=accounts[j+1]; accounts[j+1]=tmp;
-                }
-            break;
-        case 3:
-            for (int i=0; i<totalAccounts-1;++i)
-            for (int j=0;j<totalAccounts-1-i;++j)
-                if (accounts[j].balance > accounts[j+1].balance) {
-                    Account tmp = accounts[j]; accounts[j]=accounts[j+1]; accounts[j+1]=tmp;
-                }
-            break;
-        default:
-            puts("Invalid sorting option!");
-            return;
+    if (choice < 1 || choice > 3) {
+        puts("Invalid sorting option!");
+        return;
+    }
+    const int *order = getSortedView(choice - 1);
+    if (!order) {
+        puts("Not enough memory to sort accounts!");
+        return;
     }
     puts("Accounts sorted successfully!");
-    displayAllAccounts();
+    printAccounts(order);
+}
+
+// Sort (key, slot) pairs by key with an LSD radix sort, one byte per pass.
+// Passes where every key has the same byte are skipped.
+typedef struct { unsigned long long key; int slot; } SortPair;
+
+static int radixSortPairs(SortPair *pairs, int n, int keyBytes) {
+    SortPair *tmp = malloc((size_t)n * sizeof(SortPair));
+    if (!tmp) return -1;
+    SortPair *src = pairs, *dst = tmp;
+    for (int byte=0; byte<keyBytes; ++byte) {
+        int shift = byte * 8;
+        size_t count[257] = {0};
+        for (int i=0; i<n; ++i) count[((src[i].key >> shift) & 0xFF) + 1]++;
+        if (count[((src[0].key >> shift) & 0xFF) + 1] == (size_t)n) continue;
+        for (int d=0; d<256; ++d) count[d+1] += count[d];
+        for (int i=0; i<n; ++i) dst[count[(src[i].key >> shift) & 0xFF]++] = src[i];
+        SortPair *t = src; src = dst; dst = t;
+    }
+    if (src != pairs) memcpy(pairs, src, (size_t)n * sizeof(SortPair));
+    free(tmp);
+    return 0;
+}
+
+// Map a signed balance onto an unsigned key with the same ordering
+static unsigned long long balanceSortKey(Money balance) {
+    return (unsigned long long)balance ^ 0x8000000000000000ULL;
+}
+
+static int compareByFirstName(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    int c = strcmp(accounts[x].firstName, accounts[y].firstName);
+    return c ? c : (x > y) - (x < y); // ties keep slot order, like a stable sort
+}
+
+// Return the cached view for `key`, rebuilding it if a mutation invalidated it
+static const int *getSortedView(int key) {
+    if (sortedViewValid[key]) return sortedView[key];
+
+    int *order = realloc(sortedView[key], (size_t)(totalAccounts ? totalAccounts : 1) * sizeof(int));
+    if (!order) return NULL;
+    sortedView[key] = order;
+
+    if (key == SORT_BY_FIRST_NAME) {
+        for (int i=0, n=0; i<slotCount; ++i)
+            if (accounts[i].isActive != ACCOUNT_DELETED) order[n++] = i;
+        qsort(order, (size_t)totalAccounts, sizeof(int), compareByFirstName);
+    } else if (totalAccounts > 0) {
+        SortPair *pairs = malloc((size_t)totalAccounts * sizeof(SortPair));
+        if (!pairs) return NULL;
+        for (int i=0, n=0; i<slotCount; ++i) {
+            if (accounts[i].isActive == ACCOUNT_DELETED) continue;
+            pairs[n].slot = i;
+            pairs[n++].key = (key == SORT_BY_NUMBER)
+                ? (unsigned long long)((unsigned int)accounts[i].accountNumber ^ 0x80000000u)
+                : balanceSortKey(accounts[i].balance);
+        }
+        if (radixSortPairs(pairs, totalAccounts, key == SORT_BY_NUMBER ? 4 : 8) != 0) {
+            free(pairs);
+            return NULL;
+        }
+        for (int i=0; i<totalAccounts; ++i) order[i] = pairs[i].slot;
+        free(pairs);
+    }
+    sortedViewValid[key] = 1;
+    return order;
+}
+
+// Accounts were added, removed or moved: every cached view is stale
+static void invalidateSortedViews(void) {
+    for (int key=0; key<SORT_KEYS; ++key) sortedViewValid[key] = 0;
+}
+
+// Change a balance; only the balance ordering depends on it.
+// Returns -1 (balance untouched) if the result would be out of range.
+static int applyBalanceDelta(int idx, Money delta) {
+    if (moneyAdd(&accounts[idx].balance, delta) != 0) return -1;
+    sortedViewValid[SORT_BY_BALANCE] = 0;
+    return 0;
+}
+
+// Convert an entered amount to cents, rounding to the nearest cent
+static int moneyFromDouble(double value, Money *money) {
+    double cents = value * MONEY_SCALE;
+    if (!(cents > -(double)MONEY_LIMIT && cents < (double)MONEY_LIMIT)) return -1;
+    *money = (Money)(cents + (cents >= 0 ? 0.5 : -0.5));
+    return 0;
+}
+
+// Amount in dollars, for display only
+static double moneyToDouble(Money money) {
+    return (double)money / MONEY_SCALE;
+}
+
+// Reinterpret a balance written by a version that stored doubles
+static Money moneyFromStoredDouble(long long bits) {
+    double value;
+    Money money = 0;
+    memcpy(&value, &bits, sizeof(value));
+    moneyFromDouble(value, &money);
+    return money;
+}
+
+// Checked *value += delta; leaves *value alone and returns -1 on overflow
+static int moneyAdd(Money *value, Money delta) {
+    if (delta > MONEY_LIMIT || delta < -MONEY_LIMIT ||
+        (delta > 0 && *value > MONEY_LIMIT - delta) ||
+        (delta < 0 && *value < -MONEY_LIMIT - delta)) return -1;
+    *value += delta;
+    return 0;
 }
 
 void processTransaction(void) {
     puts("\n=== PROCESS TRANSACTION ===");
     printf("Enter account number: ");
     int accountNumber,choice;
-    double amount=0;
+    double input=0;
+    Money amount=0;
     if (scanf("%d", &accountNumber)!=1) { while(getchar()!='\n'); puts("Invalid account number!"); return;}
-    int idx = findAccountByNumber(accountNumber);
-    if (idx == -1) {
+    const Account *acct = bankAccount(accountNumber);
+    if (!acct) {
         puts("Account not found!");
         showTransactionConfirmation(0, "Account Lookup");
         return;
     }
-    if (!accounts[idx].isActive) {
+    if (!acct->isActive) {
         puts("ERROR: This account is inactive. Contact bank for support.");
         showTransactionConfirmation(0, "Account Inactive");
         return;
     }
-    if (!authenticateUser(idx)) {
+    if (!authenticateUser(accountNumber)) {
         puts("Authentication failed!");
         showTransactionConfirmation(0, "Authentication");
         return;
@@ -244,37 +716,508 @@ void processTransaction(void) {
         return;
     }
     printf("Enter amount: $");
-    if(scanf("%lf",&amount)!=1 || amount<=0) {
+    if(scanf("%lf",&input)!=1 || moneyFromDouble(input, &amount)!=0 || amount<=0) {
         puts("Invalid amount! Amount must be greater than 0.");
         showTransactionConfirmation(0, "Invalid Amount");
         return;
     }
-    Account *acct = &accounts[idx];
     if(choice==1) {
-        acct->balance+=amount;
+        int status = warnIfNotSaved(bankDeposit(accountNumber, amount));
+        if (status != BANK_OK) {
+            reportBalanceStatus(status, acct);
+            showTransactionConfirmation(0, "Deposit");
+            return;
+        }
         showTransactionConfirmation(1, "Deposit");
         generateReceipt(acct, "DEPOSIT", amount, acct->balance);
-        saveAccounts();
     } else if(choice==2) {
-        if(acct->balance>=amount) {
-            acct->balance-=amount;
+        int status = warnIfNotSaved(bankWithdraw(accountNumber, amount));
+        if (status == BANK_OK) {
             showTransactionConfirmation(1, "Withdrawal");
             generateReceipt(acct, "WITHDRAWAL", amount, acct->balance);
-            saveAccounts();
         } else {
-            printf("Insufficient balance! Available: $%.2f\n", acct->balance);
-            showTransactionConfirmation(0, "Insufficient Funds");
+            reportBalanceStatus(status, acct);
+            showTransactionConfirmation(0, status == BANK_INSUFFICIENT ? "Insufficient Funds" : "Withdrawal");
+        }
+    }
+}
+
+// Explain why bankDeposit or bankWithdraw turned the request down
+static void reportBalanceStatus(int status, const Account *acct) {
+    switch (status) {
+        case BANK_NOT_FOUND: puts("Account not found!"); break;
+        case BANK_INACTIVE: puts("ERROR: This account is inactive. Contact bank for support."); break;
+        case BANK_BAD_AMOUNT: puts("Invalid amount! Amount must be greater than 0."); break;
+        case BANK_INSUFFICIENT:
+            printf("Insufficient balance! Available: $%.2f\n", moneyToDouble(acct->balance));
+            break;
+        case BANK_LIMIT: puts("Deposit would exceed the maximum balance!"); break;
+        default: puts("The transaction could not be completed."); break;
+    }
+}
+
+// Look up an account; NULL if there is none. The pointer is valid until
+// accounts are added, deleted or compacted.
+const Account *bankAccount(int accountNumber) {
+    int idx = findAccountByNumber(accountNumber);
+    return idx == -1 ? NULL : &accounts[idx];
+}
+
+// Add an active account (acct->isActive is ignored) and journal it
+int bankCreateAccount(const Account *acct) {
+    Account added = *acct;
+    int status = checkNewAccount(&added);
+    if (status != BANK_OK) return status;
+    added.isActive = 1;
+    if (appendAccount(&added) != 0) return BANK_NO_MEMORY;
+    return journalAppend(JOURNAL_CREATE, &added, 0) == 0 ? BANK_OK : BANK_NOT_SAVED;
+}
+
+// Whether acct may be added: a positive unused number, a 4-digit PIN and
+// an opening balance in range. --import applies the same rules.
+static int checkNewAccount(const Account *acct) {
+    if (acct->accountNumber <= 0 || acct->pin[4] != '\0' ||
+        strspn(acct->pin, "0123456789") != 4) return BANK_INVALID;
+    if (acct->balance < 0 || acct->balance > MONEY_LIMIT) return BANK_BAD_AMOUNT;
+    if (findAccountByNumber(acct->accountNumber) != -1) return BANK_EXISTS;
+    return BANK_OK;
+}
+
+int bankDeposit(int accountNumber, Money amount) {
+    long long started = metricsNow();
+    int idx = findAccountByNumber(accountNumber);
+    if (idx == -1) return BANK_NOT_FOUND;
+    if (!accounts[idx].isActive) return BANK_INACTIVE;
+    if (amount <= 0) return BANK_BAD_AMOUNT;
+    if (applyBalanceDelta(idx, amount) != 0) return BANK_LIMIT;
+    int saved = journalAppend(JOURNAL_BALANCE, &accounts[idx], amount);
+    metricsRecord(METRIC_DEPOSIT, metricsNow() - started, 0, 0);
+    return saved == 0 ? BANK_OK : BANK_NOT_SAVED;
+}
+
+int bankWithdraw(int accountNumber, Money amount) {
+    long long started = metricsNow();
+    int idx = findAccountByNumber(accountNumber);
+    if (idx == -1) return BANK_NOT_FOUND;
+    if (!accounts[idx].isActive) return BANK_INACTIVE;
+    if (amount <= 0) return BANK_BAD_AMOUNT;
+    if (accounts[idx].balance < amount) return BANK_INSUFFICIENT;
+    applyBalanceDelta(idx, -amount);
+    int saved = journalAppend(JOURNAL_BALANCE, &accounts[idx], -amount);
+    metricsRecord(METRIC_WITHDRAW, metricsNow() - started, 0, 0);
+    return saved == 0 ? BANK_OK : BANK_NOT_SAVED;
+}
+
+// Move amount between two active accounts as one journal entry
+int bankTransfer(int fromNumber, int toNumber, Money amount) {
+    int from = findAccountByNumber(fromNumber), to = findAccountByNumber(toNumber);
+    if (from == -1 || to == -1) return BANK_NOT_FOUND;
+    if (from == to) return BANK_SAME_ACCOUNT;
+    if (!accounts[from].isActive || !accounts[to].isActive) return BANK_INACTIVE;
+    if (amount <= 0) return BANK_BAD_AMOUNT;
+    int status = transferBetween(from, to, amount);
+    if (status < 0)
+        return accounts[from].balance < amount ? BANK_INSUFFICIENT : BANK_LIMIT;
+    sortedViewValid[SORT_BY_BALANCE] = 0;
+    return status == 0 ? BANK_OK : BANK_NOT_SAVED;
+}
+
+// Activate (1) or deactivate (0) an account; no change is not journaled.
+// Any other value is refused: ACCOUNT_DELETED would leave a tombstone in the index.
+int bankSetActive(int accountNumber, int active) {
+    if (active != 0 && active != 1) return BANK_INVALID;
+    int idx = findAccountByNumber(accountNumber);
+    if (idx == -1) return BANK_NOT_FOUND;
+    if (accounts[idx].isActive != active) {
+        accounts[idx].isActive = active;
+        if (journalAppend(JOURNAL_STATUS, &accounts[idx], active) != 0) return BANK_NOT_SAVED;
+    }
+    return BANK_OK;
+}
+
+int bankDeleteAccount(int accountNumber) {
+    int idx = findAccountByNumber(accountNumber);
+    if (idx == -1) return BANK_NOT_FOUND;
+    Account deleted = accounts[idx];
+    removeAccountAt(idx);
+    return journalAppend(JOURNAL_DELETE, &deleted, 0) == 0 ? BANK_OK : BANK_NOT_SAVED;
+}
+
+// BANK_OK if pin matches the account's 4-digit PIN
+int bankCheckPin(int accountNumber, const char *pin) {
+    const Account *acct = bankAccount(accountNumber);
+    if (!acct) return BANK_NOT_FOUND;
+    return strncmp(acct->pin, pin, 4) == 0 ? BANK_OK : BANK_BAD_PIN;
+}
+
+// Call visit for every account whose first or last name contains term
+// (case-sensitive), in slot order; returns how many matched
+int bankSearch(const char *term, void (*visit)(const Account*, void*), void *context) {
+    int found = 0;
+    for (int i=0; i<slotCount; ++i) {
+        if (accounts[i].isActive == ACCOUNT_DELETED) continue;
+        if (strstr(accounts[i].firstName, term) || strstr(accounts[i].lastName, term)) {
+            if (visit) visit(&accounts[i], context);
+            found++;
+        }
+    }
+    return found;
+}
+
+// Move `amount` between two account slots under their locks and journal it
+// as a single record. Returns -1, changing nothing, if the source cannot
+// cover it or the target would pass the maximum balance, and 1 if it was
+// applied but could not be journaled. The LSN is taken while both locks are
+// held, so transfers touching the same account are journaled in the order
+// they were applied.
+static int transferBetween(int from, int to, Money amount) {
+    TransferPayload payload = {accounts[to].accountNumber, 0};
+    int status = -1;
+    long long started = journalBatching ? METRIC_UNTIMED : metricsNow(); // batches report their own rate
+
+    lockAccountPair(from, to);
+    if (accounts[from].balance >= amount && moneyAdd(&accounts[to].balance, amount) == 0) {
+        accounts[from].balance -= amount;
+        if (batchJournal) {
+            // Every LSN owns its own slot, so workers need no journal lock
+#ifndef _WIN32
+            long long lsn = __atomic_add_fetch(&journalLsn, 1, __ATOMIC_RELAXED);
+#else
+            long long lsn = ++journalLsn;
+#endif
+            TransferRecord *record = &batchJournal[lsn - batchFirstLsn];
+            memset(&record->entry, 0, sizeof(record->entry));
+            record->entry.type = JOURNAL_TRANSFER;
+            record->entry.lsn = lsn;
+            record->entry.accountNumber = accounts[from].accountNumber;
+            record->entry.payloadSize = (int)sizeof(payload);
+            record->entry.value = amount;
+            record->transfer = payload;
+            record->entry.checksum = journalChecksum(&record->entry, &record->transfer);
+            status = 0;
+        } else {
+#ifndef _WIN32
+            pthread_mutex_lock(&journalLock);
+#endif
+            status = journalWrite(JOURNAL_TRANSFER, accounts[from].accountNumber, amount, &payload, (int)sizeof(payload)) == 0 ? 0 : 1;
+#ifndef _WIN32
+            pthread_mutex_unlock(&journalLock);
+#endif
+        }
+    }
+    unlockAccountPair(from, to);
+    if (status < 0) return -1;
+    metricsRecord(METRIC_TRANSFER, journalBatching ? METRIC_UNTIMED : metricsNow() - started, 0, 0);
+    return status;
+}
+
+// Lock the stripes of two slots, lower stripe first
+static void lockAccountPair(int a, int b) {
+#ifndef _WIN32
+    int first = a % ACCOUNT_LOCK_STRIPES, second = b % ACCOUNT_LOCK_STRIPES;
+    if (first > second) { int t = first; first = second; second = t; }
+    pthread_mutex_lock(&accountLocks[first]);
+    if (second != first) pthread_mutex_lock(&accountLocks[second]);
+#else
+    (void)a; (void)b;
+#endif
+}
+
+static void unlockAccountPair(int a, int b) {
+#ifndef _WIN32
+    int first = a % ACCOUNT_LOCK_STRIPES, second = b % ACCOUNT_LOCK_STRIPES;
+    if (second != first) pthread_mutex_unlock(&accountLocks[second]);
+    pthread_mutex_unlock(&accountLocks[first]);
+#else
+    (void)a; (void)b;
+#endif
+}
+
+// FEATURE: Transfer between two accounts in one step
+void transferFunds(void) {
+    puts("\n=== TRANSFER BETWEEN ACCOUNTS ===");
+    printf("Enter account number to transfer from: ");
+    int fromNumber, toNumber;
+    double input=0;
+    Money amount=0;
+    if (scanf("%d", &fromNumber)!=1) { while(getchar()!='\n'); puts("Invalid account number!"); return;}
+    const Account *from = bankAccount(fromNumber);
+    if (!from) {
+        puts("Account not found!");
+        showTransactionConfirmation(0, "Account Lookup");
+        return;
+    }
+    if (!from->isActive) {
+        puts("ERROR: This account is inactive. Contact bank for support.");
+        showTransactionConfirmation(0, "Account Inactive");
+        return;
+    }
+    if (!authenticateUser(fromNumber)) {
+        puts("Authentication failed!");
+        showTransactionConfirmation(0, "Authentication");
+        return;
+    }
+    printf("Enter account number to transfer to: ");
+    if (scanf("%d", &toNumber)!=1) { while(getchar()!='\n'); puts("Invalid account number!"); return;}
+    const Account *to = bankAccount(toNumber);
+    if (!to || to == from || !to->isActive) {
+        puts(!to ? "Account not found!" : to == from ? "Cannot transfer to the same account!"
+                                                     : "ERROR: The receiving account is inactive.");
+        showTransactionConfirmation(0, "Transfer");
+        return;
+    }
+    printf("Enter amount: $");
+    if(scanf("%lf",&input)!=1 || moneyFromDouble(input, &amount)!=0 || amount<=0) {
+        puts("Invalid amount! Amount must be greater than 0.");
+        showTransactionConfirmation(0, "Invalid Amount");
+        return;
+    }
+    int status = warnIfNotSaved(bankTransfer(fromNumber, toNumber, amount));
+    if (status != BANK_OK) {
+        if (status == BANK_INSUFFICIENT)
+            printf("Insufficient balance! Available: $%.2f\n", moneyToDouble(from->balance));
+        else
+            puts("Transfer would exceed the maximum balance of the receiving account!");
+        showTransactionConfirmation(0, "Transfer");
+        return;
+    }
+    showTransactionConfirmation(1, "Transfer");
+    generateReceipt(from, "TRANSFER OUT", amount, from->balance);
+    generateReceipt(to, "TRANSFER IN", amount, to->balance);
+}
+
+// FEATURE: Apply a file of "from,to,amount" lines. Transfers run on several
+// threads under the per-account locks, and the batch is a single journal
+// commit: each transfer fills the slot of its LSN in batchJournal, and the
+// whole array is written and synced once at the end. If the journal cannot
+// be opened then, a checkpoint saves the batch instead.
+void batchTransfers(void) {
+    char fileName[256], line[256];
+    PendingTransfer *transfers = NULL;
+    int count = 0, capacity = 0, skipped = 0, lineNo = 0;
+    TransferBatch batch = {0};
+    long long began;
+
+    puts("\n=== BATCH TRANSFERS ===");
+    while(getchar()!='\n');
+    inputString("Enter transfer file name: ", fileName, sizeof(fileName));
+    FILE *file = fopen(fileName, "r");
+    if (!file) {
+        printf("Could not open %s!\n", fileName);
+        return;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        int fromNumber, toNumber, from, to;
+        double input;
+        Money amount;
+        const char *p = line + strspn(line, " \t");
+
+        lineNo++;
+        if (*p == '#' || *p == '\0' || *p == '\n' || *p == '\r') continue;
+        if (sscanf(p, "%d ,%d ,%lf", &fromNumber, &toNumber, &input) != 3) {
+            if (lineNo > 1) skipped++; // a header row is allowed
+            continue;
+        }
+        from = findAccountByNumber(fromNumber);
+        to = findAccountByNumber(toNumber);
+        if (from == -1 || to == -1 || from == to || !accounts[from].isActive || !accounts[to].isActive ||
+            moneyFromDouble(input, &amount) != 0 || amount <= 0) {
+            skipped++;
+            continue;
+        }
+        if (count == capacity) {
+            int newCapacity = capacity ? capacity * 2 : 1024;
+            PendingTransfer *grown = realloc(transfers, (size_t)newCapacity * sizeof(PendingTransfer));
+            if (!grown) {
+                puts("Not enough memory for the batch!");
+                free(transfers);
+                fclose(file);
+                return;
+            }
+            transfers = grown;
+            capacity = newCapacity;
+        }
+        transfers[count].from = from;
+        transfers[count].to = to;
+        transfers[count].amount = amount;
+        count++;
+    }
+    fclose(file);
+
+    batch.transfers = transfers;
+    batch.count = count;
+    int threads = transferThreadCount(count);
+    began = metricsNow();
+    journalBatching = 1;
+    batchFirstLsn = journalLsn + 1;
+    batchJournal = count > 0 ? malloc((size_t)count * sizeof(TransferRecord)) : NULL; // NULL: journalWrite each
+#ifndef _WIN32
+    pthread_t workers[TRANSFER_THREADS_MAX];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, transferWorker, &batch) == 0)
+        started++;
+    transferWorker(&batch);
+    for (int i=0; i<started; ++i) pthread_join(workers[i], NULL);
+    threads = started + 1;
+#else
+    transferWorker(&batch);
+#endif
+    journalBatching = 0;
+
+    // Commit the whole batch in LSN order with one flush and one fsync
+    // (without batchJournal each transfer went through journalWrite already)
+    if (batch.applied > 0) {
+        int failed = journalTorn || (!journal && !(journal = fopen(JOURNAL_FILE, "ab")));
+        for (int i=0; i<batch.applied && batchJournal && !failed; ++i) {
+            failed = fwrite(&batchJournal[i].entry, sizeof(JournalEntry), 1, journal) != 1 ||
+                     fwrite(&batchJournal[i].transfer, sizeof(TransferPayload), 1, journal) != 1;
+            metricsRecord(METRIC_JOURNAL, METRIC_UNTIMED, sizeof(TransferRecord), 0);
         }
+        if (!failed) {
+            journalUnsynced++;
+            failed = fflush(journal) != 0 || journalSync() != 0;
+        }
+        if (failed && journalFailed() < 0)
+            puts("Warning: Could not write the journal or save the database; the batch is not on disk yet.");
     }
+    free(batchJournal);
+    batchJournal = NULL;
+    if (journalLsn - checkpointLsn >= JOURNAL_CHECKPOINT_EVERY) writeCheckpoint();
+    sortedViewValid[SORT_BY_BALANCE] = 0;
+    double seconds = (metricsNow() - began) / 1e9;
+    free(transfers);
+
+    printf("Applied %d transfers in %.3f s on %d thread%s", batch.applied, seconds, threads, threads == 1 ? "" : "s");
+    if (seconds > 0) printf(" (%.0f transfers/s)", batch.applied / seconds);
+    printf("\n");
+    if (batch.insufficient > 0) printf("Rejected (insufficient funds or balance limit): %d\n", batch.insufficient);
+    if (skipped > 0) printf("Skipped (malformed line, unknown or inactive account): %d\n", skipped);
 }
 
-int authenticateUser(const int accountIndex) {
+// FEATURE: Create accounts from a file of "account,first name,last name,
+// balance,pin" lines. Rows are validated and checked against the account
+// index in one pass (each accepted row joins the index, so duplicates within
+// the file are caught too), then accounts.dat is rewritten once by a
+// checkpoint rather than journaling every account.
+int importAccounts(const char *fileName) {
+    char line[256];
+    int imported = 0, duplicates = 0, invalid = 0, lineNo = 0;
+    long long started;
+
+    FILE *file = fopen(fileName, "r");
+    if (!file) {
+        printf("Could not open %s!\n", fileName);
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, IMPORT_BUFFER);
+    started = metricsNow();
+    while (fgets(line, sizeof(line), file)) {
+        Account acct = {0};
+        double input;
+        int used = 0;
+        const char *p = line + strspn(line, " \t");
+
+        lineNo++;
+        if (*p == '#' || *p == '\0' || *p == '\n' || *p == '\r') continue;
+        if (sscanf(p, "%d , %49[^,], %49[^,], %lf , %4[0-9]%n", &acct.accountNumber, acct.firstName,
+                   acct.lastName, &input, acct.pin, &used) != 5 ||
+            p[used + strspn(p + used, " \t\r\n")] != '\0' ||
+            input < 0 || moneyFromDouble(input, &acct.balance) != 0) {
+            if (lineNo > 1) invalid++; // a header row is allowed
+            continue;
+        }
+        trimTrailingSpace(acct.firstName); // %[^,] keeps the spaces before a comma
+        trimTrailingSpace(acct.lastName);
+        int status = checkNewAccount(&acct);
+        if (status == BANK_EXISTS) {
+            duplicates++;
+            continue;
+        }
+        if (status != BANK_OK) {
+            invalid++;
+            continue;
+        }
+        // grow by doubling so a large file does not copy accounts[] a page at a time
+        if (freeCount == 0 && slotCount == accountCapacity &&
+            reserveAccounts(accountCapacity ? accountCapacity * 2 : ACCOUNT_PAGE) != 0) {
+            puts("Not enough memory for the import!");
+            break;
+        }
+        acct.isActive = 1;
+        if (appendAccount(&acct) != 0) {
+            puts("Not enough memory for the import!");
+            break;
+        }
+        imported++;
+    }
+    fclose(file);
+
+    // One sequential write of every account, which also folds the journal
+    if (imported > 0 && writeCheckpoint() < 0) {
+        puts("Error saving database!");
+        return -1;
+    }
+    double seconds = (metricsNow() - started) / 1e9;
+    printf("Imported %d accounts in %.3f s", imported, seconds);
+    if (seconds > 0) printf(" (%.0f accounts/s)", imported / seconds);
+    printf("\n");
+    if (duplicates > 0) printf("Skipped (account number already exists): %d\n", duplicates);
+    if (invalid > 0) printf("Skipped (malformed line, bad balance or PIN): %d\n", invalid);
+    return imported;
+}
+
+// Batch worker: claim TRANSFER_CLAIM transfers at a time until none are left
+static void *transferWorker(void *arg) {
+    TransferBatch *batch = arg;
+    int applied = 0, insufficient = 0;
+
+    for (;;) {
+#ifndef _WIN32
+        pthread_mutex_lock(&batchLock);
+#endif
+        int first = batch->next < batch->count ? batch->next : batch->count;
+        batch->next = first + TRANSFER_CLAIM;
+#ifndef _WIN32
+        pthread_mutex_unlock(&batchLock);
+#endif
+        if (first >= batch->count) break;
+        int last = first + TRANSFER_CLAIM < batch->count ? first + TRANSFER_CLAIM : batch->count;
+        for (int i=first; i<last; ++i) {
+            const PendingTransfer *t = &batch->transfers[i];
+            if (transferBetween(t->from, t->to, t->amount) >= 0) applied++;
+            else insufficient++;
+        }
+    }
+#ifndef _WIN32
+    pthread_mutex_lock(&batchLock);
+#endif
+    batch->applied += applied;
+    batch->insufficient += insufficient;
+#ifndef _WIN32
+    pthread_mutex_unlock(&batchLock);
+#endif
+    return NULL;
+}
+
+// One thread per online processor, but no more than there are claims to hand out
+static int transferThreadCount(int count) {
+    int threads = 1;
+#ifndef _WIN32
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online < 1 ? 1 : online > TRANSFER_THREADS_MAX ? TRANSFER_THREADS_MAX : (int)online;
+#endif
+    int claims = (count + TRANSFER_CLAIM - 1) / TRANSFER_CLAIM;
+    if (threads > claims) threads = claims;
+    return threads < 1 ? 1 : threads;
+}
+
+int authenticateUser(const int accountNumber) {
     for(int attempts=3; attempts>0; --attempts) {
         char enteredPin[PIN_LENGTH];
         printf("Enter your 4-digit PIN: ");
         scanf("%4s", enteredPin);
         while(getchar()!='\n'); // flush
-        if(!strncmp(accounts[accountIndex].pin, enteredPin, 4)) {
+        if(bankCheckPin(accountNumber, enteredPin) == BANK_OK) {
             puts("Authentication successful!");
             return 1;
         } else if(attempts>1)
@@ -292,38 +1235,362 @@ void showTransactionConfirmation(const int success, const char* operation) {
     puts("================================");
 }
 
-void generateReceipt(const Account *acct, const char *transactionType, double amount, double newBalance) {
-    time_t now; time(&now);
-    printf("\n=== TRANSACTION RECEIPT ===\n");
-    printf("Date & Time: %s", ctime(&now));
-    printf("Account Number: %d\n", acct->accountNumber);
-    printf("Transaction Type: %s\n", transactionType);
-    printf("Amount: $%.2f\n", amount);
-    printf("New Balance: $%.2f\n", newBalance);
-    puts("===========================");
-
-    char filename[64];
-    snprintf(filename, sizeof(filename), "receipt_%d_%ld.txt", acct->accountNumber, (long)now);
-    FILE *f = fopen(filename, "w");
-    if(f) {
-        fprintf(f, "=== TRANSACTION RECEIPT ===\n");
-        fprintf(f, "Date & Time: %s", ctime(&now));
-        fprintf(f, "Account Number: %d\n", acct->accountNumber);
-        fprintf(f, "Transaction Type: %s\n", transactionType);
-        fprintf(f, "Amount: $%.2f\n", amount);
-        fprintf(f, "New Balance: $%.2f\n", newBalance);
-        fputs("===========================\n",f);
-        fclose(f);
-        printf("Receipt saved as: %s\n", filename);
+// Show a receipt and append it to receipts.log. Called right after the
+// transaction's journal entry, whose LSN becomes the receipt number; the
+// LSN is used up even when the change went to a checkpoint instead.
+void generateReceipt(const Account *acct, const char *transactionType, Money amount, Money newBalance) {
+    Receipt receipt = {0};
+    receipt.id = journalLsn;
+    receipt.time = (long long)time(NULL);
+    receipt.accountNumber = acct->accountNumber;
+    snprintf(receipt.type, sizeof(receipt.type), "%s", transactionType);
+    receipt.amount = amount;
+    receipt.balance = newBalance;
+    printReceipt(stdout, &receipt);
+
+    if (!receiptLog) {
+        if (!(receiptLog = fopen(RECEIPT_LOG, "ab"))) {
+            puts("Could not open the receipt log!");
+            return;
+        }
+        fseek(receiptLog, 0, SEEK_END);
+        receiptLogSize = ftell(receiptLog);
     }
+    int written = fprintf(receiptLog, "%lld\t%lld\t%d\t%s\t%lld\t%lld\n", receipt.id, receipt.time,
+                          receipt.accountNumber, receipt.type, receipt.amount, receipt.balance);
+    if (written > 0) receiptLogSize += written;
+    fflush(receiptLog); // a crash must not lose receipts whose transactions are journaled
+    printf("Receipt No. %lld logged to %s\n", receipt.id, RECEIPT_LOG);
+    if (receiptLogSize >= RECEIPT_LOG_LIMIT) rotateReceiptLog();
 }
 
-int findAccountByNumber(const int accountNumber) {
-    for(int i=0; i<totalAccounts; ++i)
-        if(accounts[i].accountNumber==accountNumber) return i;
+static void printReceipt(FILE *out, const Receipt *receipt) {
+    time_t when = (time_t)receipt->time;
+    char date[32] = "";
+    struct tm *local = localtime(&when);
+    if (local) strftime(date, sizeof(date), "%a %b %d %H:%M:%S %Y", local);
+    fprintf(out, "\n=== TRANSACTION RECEIPT ===\n");
+    fprintf(out, "Receipt No.: %lld\n", receipt->id);
+    fprintf(out, "Date & Time: %s\n", date);
+    fprintf(out, "Account Number: %d\n", receipt->accountNumber);
+    fprintf(out, "Transaction Type: %s\n", receipt->type);
+    fprintf(out, "Amount: $%.2f\n", moneyToDouble(receipt->amount));
+    fprintf(out, "New Balance: $%.2f\n", moneyToDouble(receipt->balance));
+    fputs("===========================\n", out);
+}
+
+// Start a new receipts.log, keeping the newest RECEIPT_LOG_KEEP old ones
+static void rotateReceiptLog(void) {
+    char from[32], to[32];
+    closeReceiptLog();
+    for (int n = RECEIPT_LOG_KEEP; n > 1; --n) {
+        snprintf(from, sizeof(from), "%s.%d", RECEIPT_LOG, n - 1);
+        snprintf(to, sizeof(to), "%s.%d", RECEIPT_LOG, n);
+        remove(to);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", RECEIPT_LOG);
+    remove(to);
+    rename(RECEIPT_LOG, to);
+}
+
+static void closeReceiptLog(void) {
+    if (receiptLog) fclose(receiptLog);
+    receiptLog = NULL;
+    receiptLogSize = 0;
+}
+
+// Print the receipts with the given id, or every receipt of an account
+// (id 0), from the rotated logs oldest first. Returns how many were found.
+static int showReceipts(long long id, int accountNumber) {
+    char name[32], line[256];
+    int found = 0;
+    for (int n = RECEIPT_LOG_KEEP; n >= 0; --n) {
+        if (n > 0) snprintf(name, sizeof(name), "%s.%d", RECEIPT_LOG, n);
+        else snprintf(name, sizeof(name), "%s", RECEIPT_LOG);
+        FILE *file = fopen(name, "r");
+        if (!file) continue;
+        while (fgets(line, sizeof(line), file)) {
+            Receipt receipt;
+            if (sscanf(line, "%lld\t%lld\t%d\t%15[^\t]\t%lld\t%lld", &receipt.id, &receipt.time,
+                       &receipt.accountNumber, receipt.type, &receipt.amount, &receipt.balance) != 6) continue;
+            if (id ? receipt.id != id : receipt.accountNumber != accountNumber) continue;
+            printReceipt(stdout, &receipt);
+            found++;
+        }
+        fclose(file);
+    }
+    if (!found) puts("No matching receipts found.");
+    return found;
+}
+
+static unsigned int hashAccountNumber(int accountNumber) {
+    unsigned int h = (unsigned int)accountNumber;
+    h ^= h >> 16; h *= 0x45d9f3bu;
+    h ^= h >> 16; h *= 0x45d9f3bu;
+    h ^= h >> 16;
+    return h;
+}
+
+// Rebuild the index from the live slots of accounts[], sized for `entries`
+static void rebuildIndexFor(int entries) {
+    int capacity = 16;
+    while (capacity < entries * 2) capacity *= 2;
+    if (capacity != indexCapacity) {
+        int *table = realloc(accountIndex, (size_t)capacity * sizeof(int));
+        if (!table) { puts("Out of memory building account index!"); exit(1); }
+        accountIndex = table;
+        indexCapacity = capacity;
+    }
+    for (int i=0; i<indexCapacity; ++i) accountIndex[i] = INDEX_EMPTY;
+    for (int slot=0; slot<slotCount; ++slot) {
+        if (accounts[slot].isActive == ACCOUNT_DELETED) continue;
+        unsigned int i = hashAccountNumber(accounts[slot].accountNumber) & (indexCapacity-1);
+        while (accountIndex[i] != INDEX_EMPTY) i = (i+1) & (indexCapacity-1);
+        accountIndex[i] = slot;
+    }
+}
+
+static void rebuildIndex(void) {
+    rebuildIndexFor(totalAccounts);
+}
+
+// Add accounts[slot]; the caller has grown the table for it
+static void indexInsert(int slot) {
+    unsigned int i = hashAccountNumber(accounts[slot].accountNumber) & (indexCapacity-1);
+    while (accountIndex[i] != INDEX_EMPTY) i = (i+1) & (indexCapacity-1);
+    accountIndex[i] = slot;
+}
+
+// Find the table position holding accountNumber, or -1
+static int indexPosition(int accountNumber) {
+    if (indexCapacity == 0) return -1;
+    unsigned int i = hashAccountNumber(accountNumber) & (indexCapacity-1);
+    while (accountIndex[i] != INDEX_EMPTY) {
+        if (accounts[accountIndex[i]].accountNumber == accountNumber) return (int)i;
+        i = (i+1) & (indexCapacity-1);
+    }
     return -1;
 }
 
+// Remove accountNumber, shifting later entries of its probe run back so
+// lookups never need tombstones
+static void indexRemove(int accountNumber) {
+    int pos = indexPosition(accountNumber);
+    if (pos < 0) return;
+    unsigned int mask = (unsigned int)indexCapacity - 1;
+    unsigned int hole = (unsigned int)pos, i = hole;
+    for (;;) {
+        i = (i+1) & mask;
+        if (accountIndex[i] == INDEX_EMPTY) break;
+        unsigned int home = hashAccountNumber(accounts[accountIndex[i]].accountNumber) & mask;
+        // move the entry into the hole unless its home lies cyclically in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            accountIndex[hole] = accountIndex[i];
+            hole = i;
+        }
+    }
+    accountIndex[hole] = INDEX_EMPTY;
+}
+
+int findAccountByNumber(const int accountNumber) {
+    int pos = indexPosition(accountNumber);
+    metricsRecord(METRIC_LOOKUP, METRIC_UNTIMED, 0, pos >= 0);
+    return pos < 0 ? -1 : accountIndex[pos];
+}
+
+// Add an account in a freed slot, or at the end of accounts[], and index it
+static int appendAccount(const Account *acct) {
+    int slot;
+    if (freeCount > 0) {
+        slot = freeSlots[--freeCount];
+    } else {
+        if (reserveAccounts(slotCount + 1) != 0) return -1;
+        slot = slotCount++;
+    }
+    // grow the index (load factor at most 1/2) while the slot is still a tombstone
+    if ((totalAccounts + 1) * 2 > indexCapacity) rebuildIndexFor(totalAccounts + 1);
+    accounts[slot] = *acct;
+    indexInsert(slot);
+    totalAccounts++;
+    invalidateSortedViews();
+    return 0;
+}
+
+// Delete accounts[idx] in O(1): tombstone the slot and push it on the free
+// list. No other account moves, so slots held elsewhere stay valid until
+// compactAccounts runs.
+static void removeAccountAt(int idx) {
+    indexRemove(accounts[idx].accountNumber);
+    memset(&accounts[idx], 0, sizeof(Account));
+    accounts[idx].isActive = ACCOUNT_DELETED;
+    totalAccounts--;
+    invalidateSortedViews();
+    if (freeCount == freeCapacity) {
+        int newCapacity = freeCapacity ? freeCapacity * 2 : 64;
+        int *grown = realloc(freeSlots, (size_t)newCapacity * sizeof(int));
+        if (!grown) return; // the slot stays a tombstone until compaction
+        freeSlots = grown;
+        freeCapacity = newCapacity;
+    }
+    freeSlots[freeCount++] = idx;
+}
+
+// Slide the live accounts down over the tombstones, keeping their order
+static void compactAccounts(void) {
+    int live = 0;
+    for (int slot=0; slot<slotCount; ++slot)
+        if (accounts[slot].isActive != ACCOUNT_DELETED) accounts[live++] = accounts[slot];
+    memset(accounts + live, 0, (size_t)(slotCount - live) * sizeof(Account));
+    slotCount = live;
+    freeCount = 0;
+    rebuildIndex();
+    invalidateSortedViews();
+}
+
+// Compact once tombstones make up COMPACT_TOMBSTONE_SHARE of the used
+// slots. Runs from the menu loop, between commands, so deletes stay O(1).
+static void compactIfSparse(void) {
+    int tombstones = slotCount - totalAccounts;
+    if (tombstones > 0 && slotCount >= ACCOUNT_PAGE &&
+        tombstones * COMPACT_TOMBSTONE_SHARE >= slotCount)
+        compactAccounts();
+}
+
+static unsigned int journalChecksum(const JournalEntry *entry, const void *payload) {
+    const unsigned char *p = (const unsigned char *)entry + offsetof(JournalEntry, type);
+    size_t n = sizeof(JournalEntry) - offsetof(JournalEntry, type);
+    unsigned int h = 2166136261u;
+    for (size_t i=0; i<n; ++i) { h ^= p[i]; h *= 16777619u; }
+    if (payload) {
+        p = (const unsigned char *)payload;
+        for (int i=0; i<entry->payloadSize; ++i) { h ^= p[i]; h *= 16777619u; }
+    }
+    return h;
+}
+
+// Append one change to the journal. The write reaches the OS immediately;
+// fsync is batched over JOURNAL_SYNC_EVERY appends.
+static int journalAppend(int type, const Account *acct, long long value) {
+    if (type == JOURNAL_CREATE)
+        return journalWrite(type, acct->accountNumber, value, acct, (int)sizeof(Account));
+    return journalWrite(type, acct->accountNumber, value, NULL, 0);
+}
+
+// Write one entry and its payload. Inside a batch the caller holds
+// journalLock, and syncing and checkpointing wait for the batch to end.
+// If the journal cannot be opened, written or synced a checkpoint saves
+// the change instead; returns -1 if that is not possible (or a batch is
+// running) either.
+static int journalWrite(int type, int accountNumber, long long value, const void *payload, int payloadSize) {
+    JournalEntry entry;
+    long long started = journalBatching ? METRIC_UNTIMED : metricsNow(); // a batch only buffers
+    long long lsn = ++journalLsn; // taken even if the entry is never written: receipts use it
+
+    if (journalTorn || (!journal && !(journal = fopen(JOURNAL_FILE, "ab"))))
+        return journalBatching ? -1 : journalFailed();
+    memset(&entry, 0, sizeof(entry));
+    entry.type = type;
+    entry.lsn = lsn;
+    entry.accountNumber = accountNumber;
+    entry.payloadSize = payload ? payloadSize : 0;
+    entry.value = value;
+    entry.checksum = journalChecksum(&entry, payload);
+    int failed = fwrite(&entry, sizeof(entry), 1, journal) != 1 ||
+                 (payload && fwrite(payload, (size_t)payloadSize, 1, journal) != 1) ||
+                 (!journalBatching && fflush(journal) != 0);
+    metricsRecord(METRIC_JOURNAL, journalBatching ? METRIC_UNTIMED : metricsNow() - started,
+                  sizeof(entry) + (size_t)entry.payloadSize, 0);
+    if (journalBatching) { // the batch's end sees journalTorn and checkpoints
+        if (failed) journalTorn = 1;
+        return failed ? -1 : 0;
+    }
+    if (failed) return journalFailed();
+
+    if (++journalUnsynced >= JOURNAL_SYNC_EVERY && journalSync() != 0) return journalFailed();
+    if (journalLsn - checkpointLsn >= JOURNAL_CHECKPOINT_EVERY) writeCheckpoint();
+    return 0;
+}
+
+// The journal could not be opened, written or synced. What it holds may
+// end in part of an entry, and replay stops there, so nothing more is
+// appended to it until a checkpoint has saved every change and started a
+// new one. Returns -1 if that checkpoint fails too.
+static int journalFailed(void) {
+    if (journal) {
+        fclose(journal);
+        journal = NULL;
+        journalTorn = 1;
+    }
+    return writeCheckpoint() < 0 ? -1 : 0;
+}
+
+// Returns -1 if the journal could not be synced
+static int journalSync(void) {
+    int failed = 0;
+    if (journal && journalUnsynced > 0) {
+        long long started = metricsNow();
+        failed = fsync(fileno(journal)) != 0;
+        if (receiptLog) fsync(fileno(receiptLog));
+        metricsRecord(METRIC_FSYNC, metricsNow() - started, 0, 0);
+        journalUnsynced = 0;
+    }
+    return failed ? -1 : 0;
+}
+
+// Re-apply journal entries newer than the loaded checkpoint. Replay stops
+// at the first torn or corrupt entry; anything in the journal is folded
+// into a fresh checkpoint so later appends never follow a torn tail.
+static void replayJournal(void) {
+    FILE *file = fopen(JOURNAL_FILE, "rb");
+    JournalEntry entry;
+    union { Account account; TransferPayload transfer; } payload;
+    int replayed = 0, nonEmpty;
+
+    if (!file) return;
+    while (fread(&entry, sizeof(entry), 1, file) == 1) {
+        int expected = entry.type == JOURNAL_CREATE ? (int)sizeof(Account)
+                     : entry.type == JOURNAL_TRANSFER ? (int)sizeof(TransferPayload) : 0;
+        if (entry.payloadSize != expected) break;
+        if (entry.payloadSize && fread(&payload, (size_t)entry.payloadSize, 1, file) != 1) break;
+        if (entry.checksum != journalChecksum(&entry, entry.payloadSize ? &payload : NULL)) break;
+        if (entry.lsn <= checkpointLsn) continue;
+
+        int idx = findAccountByNumber(entry.accountNumber);
+        if (legacyBalances) {
+            // Journal written before Money: values and payload balances are doubles
+            if (entry.type == JOURNAL_STATUS) {
+                double status;
+                memcpy(&status, &entry.value, sizeof(status));
+                entry.value = (long long)status;
+            } else {
+                entry.value = moneyFromStoredDouble(entry.value);
+            }
+            if (entry.payloadSize) payload.account.balance = moneyFromStoredDouble(payload.account.balance);
+        }
+        switch (entry.type) {
+            case JOURNAL_CREATE: if (idx == -1) appendAccount(&payload.account); break;
+            case JOURNAL_BALANCE: if (idx != -1) applyBalanceDelta(idx, entry.value); break;
+            case JOURNAL_STATUS: if (idx != -1) accounts[idx].isActive = (int)entry.value; break;
+            case JOURNAL_DELETE: if (idx != -1) removeAccountAt(idx); break;
+            case JOURNAL_TRANSFER: {
+                int to = findAccountByNumber(payload.transfer.toAccount);
+                if (idx != -1 && to != -1 && applyBalanceDelta(idx, -entry.value) == 0)
+                    applyBalanceDelta(to, entry.value);
+                break;
+            }
+        }
+        journalLsn = entry.lsn;
+        replayed++;
+    }
+    nonEmpty = ftell(file) > 0;
+    fclose(file);
+
+    if (replayed > 0) printf("Replayed %d journal entries.\n", replayed);
+    if (nonEmpty && writeCheckpoint() < 0) puts("Error checkpointing database!");
+}
+
+
 // FEATURE: Deactivate or Delete an Account
 void deactivateOrDeleteAccount(void) {
     int accNum;
@@ -334,12 +1601,11 @@ void deactivateOrDeleteAccount(void) {
         while(getchar()!='\n');
         return;
     }
-    int idx = findAccountByNumber(accNum);
-    if (idx == -1) {
+    const Account *acct = bankAccount(accNum);
+    if (!acct) {
         puts("Account not found!");
         return;
     }
-    Account *acct = &accounts[idx];
     printf("Account found: %s %s | Status: %s\n",
            acct->firstName, acct->lastName,
            acct->isActive ? "Active" : "Inactive");
@@ -361,16 +1627,11 @@ void deactivateOrDeleteAccount(void) {
             puts("Account is already inactive.");
             return;
         }
-        acct->isActive = 0;
-        saveAccounts();
+        warnIfNotSaved(bankSetActive(accNum, 0));
         puts("Account deactivated successfully.");
     } 
     else if (choice == 2) {
-        for (int i = idx; i < totalAccounts - 1; i++) {
-            accounts[i] = accounts[i + 1];
-        }
-        totalAccounts--;
-        saveAccounts();
+        warnIfNotSaved(bankDeleteAccount(accNum));
         puts("Account deleted PERMANENTLY.");
     } else {
         puts("Invalid choice.");
@@ -387,17 +1648,186 @@ void activateAccount(void) {
         while(getchar()!='\n');
         return;
     }
-    int idx = findAccountByNumber(accNum);
-    if (idx == -1) {
+    const Account *acct = bankAccount(accNum);
+    if (!acct) {
         puts("Account not found!");
         return;
     }
-    Account *acct = &accounts[idx];
     if (acct->isActive) {
         puts("This account is already active.");
         return;
     }
-    acct->isActive = 1;
-    saveAccounts();
+    warnIfNotSaved(bankSetActive(accNum, 1));
     puts("Account activated successfully.");
 }
+
+// The change went through in memory but reached neither the journal nor
+// accounts.dat; say so, then carry on as if it had succeeded.
+static int warnIfNotSaved(int status) {
+    if (status != BANK_NOT_SAVED) return status;
+    puts("Warning: Could not write the journal or save the database; the change is not on disk yet.");
+    return BANK_OK;
+}
+
+#ifndef _WIN32
+// A worker thread is exiting: its block (and its counts) go to the next thread
+static void metricsRelease(void *block) {
+    pthread_mutex_lock(&metricsLock);
+    ((MetricsBlock *)block)->inUse = 0;
+    pthread_mutex_unlock(&metricsLock);
+}
+
+// Waits for SIGUSR1, which every other thread has blocked
+static void *metricsSignalWaiter(void *arg) {
+    sigset_t signals;
+    int signum;
+    (void)arg;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    while (sigwait(&signals, &signum) == 0) metricsDump(stderr);
+    return NULL;
+}
+#endif
+
+// Runs first in main, so threads started later inherit SIGUSR1 blocked
+static void metricsStart(void) {
+    metricsStarted = metricsNow();
+#ifndef _WIN32
+    sigset_t signals;
+    pthread_t waiter;
+    pthread_key_create(&metricsKey, metricsRelease);
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    if (pthread_create(&waiter, NULL, metricsSignalWaiter, NULL) == 0) pthread_detach(waiter);
+#endif
+}
+
+// Monotonic where available, so wall-clock steps never show up as latency
+static long long metricsNow(void) {
+    struct timespec now;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+    timespec_get(&now, TIME_UTC);
+#endif
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// The calling thread's block; only the first call in a thread locks
+static MetricsBlock *metricsLocal(void) {
+#ifndef _WIN32
+    if (metricsMine) return metricsMine;
+    pthread_mutex_lock(&metricsLock);
+    MetricsBlock *block = metricsBlocks;
+    while (block && block->inUse) block = block->next;
+    if (!block && (block = calloc(1, sizeof(*block)))) {
+        block->next = metricsBlocks;
+        metricsBlocks = block;
+    }
+    if (block) {
+        block->inUse = 1;
+        metricsMine = block;
+        if (metricsStarted) pthread_setspecific(metricsKey, block);
+    }
+    pthread_mutex_unlock(&metricsLock);
+    return block;
+#else
+    if (!metricsBlocks) metricsBlocks = calloc(1, sizeof(*metricsBlocks));
+    return metricsBlocks;
+#endif
+}
+
+static unsigned int metricsBucket(unsigned long long nanos) {
+    if (nanos < METRIC_LINEAR) return (unsigned int)nanos;
+#if defined(__GNUC__)
+    unsigned int exponent = 63 - (unsigned int)__builtin_clzll(nanos);
+#else
+    unsigned int exponent = 4;
+    while (nanos >> (exponent + 1)) exponent++;
+#endif
+    return METRIC_LINEAR + (exponent - 4) * METRIC_SUB_BUCKETS +
+           (unsigned int)((nanos >> (exponent - 3)) & (METRIC_SUB_BUCKETS - 1));
+}
+
+// Largest latency in a bucket
+static unsigned long long metricsBucketLimit(unsigned int bucket) {
+    if (bucket < METRIC_LINEAR) return bucket;
+    unsigned int exponent = (bucket - METRIC_LINEAR) / METRIC_SUB_BUCKETS + 4;
+    unsigned int sub = (bucket - METRIC_LINEAR) % METRIC_SUB_BUCKETS;
+    return ((unsigned long long)(METRIC_SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+}
+
+// Count one operation of `nanos` (METRIC_UNTIMED: count only) moving `bytes`.
+// Only the owning thread writes a block, so a relaxed store per field will do.
+static void metricsRecord(int op, long long nanos, size_t bytes, int hit) {
+    MetricsBlock *block = metricsLocal();
+    if (!block) return;
+    MetricCounters *c = &block->ops[op];
+    METRIC_STORE(c->count, c->count + 1);
+    METRIC_STORE(c->bytes, c->bytes + bytes);
+    if (hit) METRIC_STORE(c->hits, c->hits + 1);
+    if (nanos == METRIC_UNTIMED) return;
+    unsigned long long value = nanos > 0 ? (unsigned long long)nanos : 0;
+    unsigned int bucket = metricsBucket(value);
+    METRIC_STORE(c->timed, c->timed + 1);
+    METRIC_STORE(c->totalNanos, c->totalNanos + value);
+    METRIC_STORE(c->buckets[bucket], c->buckets[bucket] + 1);
+    if (value > c->maxNanos) METRIC_STORE(c->maxNanos, value);
+}
+
+// One JSON line: per operation its count, bytes, hit rate (lookup), mean and
+// p50/p99/p99.9/max latency in microseconds (the top of the percentile's bucket)
+static void metricsDump(FILE *out) {
+    static const char *names[METRIC_OPS] = {
+        "lookup", "deposit", "withdraw", "transfer", "journal", "fsync", "checkpoint"
+    };
+    static const unsigned int permille[] = {500, 990, 999};
+    static const char *labels[] = {"p50_us", "p99_us", "p999_us"};
+    static MetricCounters total[METRIC_OPS];  // the waiter thread is the only caller
+
+#ifndef _WIN32
+    pthread_mutex_lock(&metricsLock);
+#endif
+    memset(total, 0, sizeof(total));
+    for (MetricsBlock *block = metricsBlocks; block; block = block->next) {
+        for (int op=0; op<METRIC_OPS; ++op) {
+            const MetricCounters *from = &block->ops[op];
+            MetricCounters *to = &total[op];
+            unsigned long long maxNanos = METRIC_LOAD(from->maxNanos);
+            to->count += METRIC_LOAD(from->count);
+            to->bytes += METRIC_LOAD(from->bytes);
+            to->hits += METRIC_LOAD(from->hits);
+            to->timed += METRIC_LOAD(from->timed);
+            to->totalNanos += METRIC_LOAD(from->totalNanos);
+            if (maxNanos > to->maxNanos) to->maxNanos = maxNanos;
+            for (int i=0; i<METRIC_BUCKETS; ++i)
+                to->buckets[i] += METRIC_LOAD(from->buckets[i]);
+        }
+    }
+#ifndef _WIN32
+    pthread_mutex_unlock(&metricsLock);
+#endif
+
+    fprintf(out, "{\"uptime_s\":%.3f,\"ops\":{", (metricsNow() - metricsStarted) / 1e9);
+    for (int op=0; op<METRIC_OPS; ++op) {
+        const MetricCounters *c = &total[op];
+        fprintf(out, "%s\"%s\":{\"count\":%llu,\"bytes\":%llu", op ? "," : "", names[op], c->count, c->bytes);
+        if (op == METRIC_LOOKUP)
+            fprintf(out, ",\"hit_rate\":%.4f", c->count ? (double)c->hits / c->count : 0.0);
+        if (c->timed) {
+            fprintf(out, ",\"mean_us\":%.3f", c->totalNanos / 1e3 / c->timed);
+            for (int p=0; p<3; ++p) {
+                unsigned long long rank = (c->timed * permille[p] + 999) / 1000, seen = 0;
+                unsigned int bucket = 0;
+                while (bucket < METRIC_BUCKETS - 1 && (seen += c->buckets[bucket]) < rank) bucket++;
+                unsigned long long limit = metricsBucketLimit(bucket);
+                fprintf(out, ",\"%s\":%.3f", labels[p], (limit < c->maxNanos ? limit : c->maxNanos) / 1e3);
+            }
+            fprintf(out, ",\"max_us\":%.3f", c->maxNanos / 1e3);
+        }
+        fputc('}', out);
+    }
+    fputs("}}\n", out);
+    fflush(out);
+}
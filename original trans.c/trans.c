@@ -3,21 +3,54 @@
 // be placed in the file, and deletes data previously in the file.
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// money is kept in cents so balances are exact
+typedef long long money_t;
+#define MONEY_SCALE 100
+#define MONEY_LIMIT 900000000000000000LL // largest magnitude accepted, in cents
+#define CREDIT_MAGIC 0x32434354u         // "TCC2": credit.dat with cent balances
+#define CREDIT_FILE "credit.dat"
+#define CREDIT_TEMP "credit.dat.tmp"     // conversion output, renamed over CREDIT_FILE
+#define MAX_ACCOUNT 100                  // accounts are numbered 1 - MAX_ACCOUNT; slot 0 is the header
+#define EXPORT_BLOCK 256                 // records read at a time by textFile
+#define EXPORT_BUFFER 65536              // bytes of text gathered per write
+#define EXPORT_LINE_MAX 64               // longest formatted record line
+
 // clientData structure definition
 struct clientData
 {
     unsigned int acctNum; // account number
     char lastName[15];    // account last name
     char firstName[10];   // account first name
-    double balance;       // account balance
+    money_t balance;      // account balance in cents
 };                        // end structure clientData
 
+// credit.dat starts with a header the size of one record, so account n
+// is stored at offset n * sizeof(struct clientData). Older files have no
+// header and hold the balance as a double.
+struct creditHeader
+{
+    unsigned int magic;   // CREDIT_MAGIC
+    unsigned int version; // 2
+    char reserved[sizeof(struct clientData) - 2 * sizeof(unsigned int)];
+}; // end structure creditHeader
+
 // prototypes
 unsigned int enterChoice(void);
 void textFile(FILE *readPtr);
 void updateRecord(FILE *fPtr);
 void newRecord(FILE *fPtr);
 void deleteRecord(FILE *fPtr);
+int convertCreditFile(FILE **fPtr);
+int validAccount(unsigned int account);
+int toCents(double amount, money_t *cents);
+double toDollars(money_t cents);
+int addMoney(money_t *balance, money_t amount);
+size_t formatRecord(char *line, const struct clientData *client);
+size_t formatPadded(char *dest, const char *text, size_t length, size_t width, int rightAlign);
+size_t formatNumber(char *dest, unsigned long long value);
+size_t fieldLength(const char *text, size_t size);
 
 int main(int argc, char *argv[])
 {
@@ -25,12 +58,23 @@ int main(int argc, char *argv[])
     unsigned int choice; // user's choice
 
     // fopen opens the file; exits if file cannot be opened
-    if ((cfPtr = fopen("credit.dat", "rb+")) == NULL)
+    if ((cfPtr = fopen(CREDIT_FILE, "rb+")) == NULL)
     {
         printf("%s: File could not be opened.\n", argv[0]);
         exit(-1);
     }
 
+    // convert a credit.dat written with double balances
+    if (convertCreditFile(&cfPtr) != 0)
+    {
+        printf("%s: credit.dat could not be converted.\n", argv[0]);
+        if (cfPtr != NULL)
+        {
+            fclose(cfPtr);
+        } // end if
+        exit(-1);
+    }
+
     // enable user to specify action
     while ((choice = enterChoice()) != 5)
     {
@@ -66,9 +110,11 @@ int main(int argc, char *argv[])
 void textFile(FILE *readPtr)
 {
     FILE *writePtr; // accounts.txt file pointer
-    int result;     // used to test whether fread read any bytes
-    // create clientData with default information
-    struct clientData client = {0, "", "", 0.0};
+    size_t result;  // number of records fread read
+    // records are read a block at a time and their lines gathered in text
+    static struct clientData block[EXPORT_BLOCK];
+    static char text[EXPORT_BUFFER];
+    size_t length = 0;
 
     // fopen opens the file; exits if file cannot be opened
     if ((writePtr = fopen("accounts.txt", "w")) == NULL)
@@ -77,21 +123,30 @@ void textFile(FILE *readPtr)
     } // end if
     else
     {
-        rewind(readPtr); // sets pointer to beginning of file
+        // sets pointer to the first record, just past the header
+        fseek(readPtr, sizeof(struct clientData), SEEK_SET);
         fprintf(writePtr, "%-6s%-16s%-11s%10s\n", "Acct", "Last Name", "First Name", "Balance");
 
         // copy all records from random-access file into text file
-        while (!feof(readPtr))
+        while ((result = fread(block, sizeof(struct clientData), EXPORT_BLOCK, readPtr)) > 0)
         {
-            result = fread(&client, sizeof(struct clientData), 1, readPtr);
-
-            // write single record to text file
-            if (result != 0 && client.acctNum != 0)
+            for (size_t i = 0; i < result; i++)
             {
-                fprintf(writePtr, "%-6d%-16s%-11s%10.2f\n", client.acctNum, client.lastName, client.firstName,
-                        client.balance);
-            } // end if
+                if (block[i].acctNum == 0)
+                {
+                    continue;
+                } // end if
+
+                // write out the gathered lines once another might not fit
+                if (length + EXPORT_LINE_MAX > sizeof(text))
+                {
+                    fwrite(text, 1, length, writePtr);
+                    length = 0;
+                } // end if
+                length += formatRecord(text + length, &block[i]);
+            } // end for
         }     // end while
+        fwrite(text, 1, length, writePtr);
 
         fclose(writePtr); // fclose closes the file
     }                     // end else
@@ -100,17 +155,22 @@ void textFile(FILE *readPtr)
 // update balance in record
 void updateRecord(FILE *fPtr)
 {
-    unsigned int account; // account number
-    double transaction;   // transaction amount
+    unsigned int account = 0; // account number
+    double amount;            // transaction amount as entered
+    money_t transaction;  // transaction amount in cents
     // create clientData with no information
-    struct clientData client = {0, "", "", 0.0};
+    struct clientData client = {0, "", "", 0};
 
     // obtain number of account to update
     printf("%s", "Enter account to update ( 1 - 100 ): ");
     scanf("%d", &account);
+    if (!validAccount(account))
+    {
+        return;
+    } // end if
 
     // move file pointer to correct record in file
-    fseek(fPtr, (account - 1) * sizeof(struct clientData), SEEK_SET);
+    fseek(fPtr, account * sizeof(struct clientData), SEEK_SET);
     // read record from file
     fread(&client, sizeof(struct clientData), 1, fPtr);
     // display error if account does not exist
@@ -120,14 +180,20 @@ void updateRecord(FILE *fPtr)
     }
     else
     { // update record
-        printf("%-6d%-16s%-11s%10.2f\n\n", client.acctNum, client.lastName, client.firstName, client.balance);
+        printf("%-6d%-16s%-11s%10.2f\n\n", client.acctNum, client.lastName, client.firstName, toDollars(client.balance));
 
         // request transaction amount from user
         printf("%s", "Enter charge ( + ) or payment ( - ): ");
-        scanf("%lf", &transaction);
-        client.balance += transaction; // update record balance
+        scanf("%lf", &amount);
+
+        // update record balance, refusing amounts that would overflow it
+        if (toCents(amount, &transaction) != 0 || addMoney(&client.balance, transaction) != 0)
+        {
+            puts("Amount out of range.");
+            return;
+        } // end if
 
-        printf("%-6d%-16s%-11s%10.2f\n", client.acctNum, client.lastName, client.firstName, client.balance);
+        printf("%-6d%-16s%-11s%10.2f\n", client.acctNum, client.lastName, client.firstName, toDollars(client.balance));
 
         // move file pointer to correct record in file
         // move back by 1 record length
@@ -142,14 +208,18 @@ void deleteRecord(FILE *fPtr)
 {
     struct clientData client;                       // stores record read from file
     struct clientData blankClient = {0, "", "", 0}; // blank client
-    unsigned int accountNum;                        // account number
+    unsigned int accountNum = 0;                    // account number
 
     // obtain number of account to delete
     printf("%s", "Enter account number to delete ( 1 - 100 ): ");
     scanf("%d", &accountNum);
+    if (!validAccount(accountNum))
+    {
+        return;
+    } // end if
 
     // move file pointer to correct record in file
-    fseek(fPtr, (accountNum - 1) * sizeof(struct clientData), SEEK_SET);
+    fseek(fPtr, accountNum * sizeof(struct clientData), SEEK_SET);
     // read record from file
     fread(&client, sizeof(struct clientData), 1, fPtr);
     // display error if record does not exist
@@ -160,7 +230,7 @@ void deleteRecord(FILE *fPtr)
     else
     { // delete record
         // move file pointer to correct record in file
-        fseek(fPtr, (accountNum - 1) * sizeof(struct clientData), SEEK_SET);
+        fseek(fPtr, accountNum * sizeof(struct clientData), SEEK_SET);
         // replace existing record with blank record
         fwrite(&blankClient, sizeof(struct clientData), 1, fPtr);
     } // end else
@@ -170,15 +240,20 @@ void deleteRecord(FILE *fPtr)
 void newRecord(FILE *fPtr)
 {
     // create clientData with default information
-    struct clientData client = {0, "", "", 0.0};
-    unsigned int accountNum; // account number
+    struct clientData client = {0, "", "", 0};
+    unsigned int accountNum = 0; // account number
+    double balance;              // opening balance as entered
 
     // obtain number of account to create
     printf("%s", "Enter new account number ( 1 - 100 ): ");
     scanf("%d", &accountNum);
+    if (!validAccount(accountNum))
+    {
+        return;
+    } // end if
 
     // move file pointer to correct record in file
-    fseek(fPtr, (accountNum - 1) * sizeof(struct clientData), SEEK_SET);
+    fseek(fPtr, accountNum * sizeof(struct clientData), SEEK_SET);
     // read record from file
     fread(&client, sizeof(struct clientData), 1, fPtr);
     // display error if account already exists
@@ -190,16 +265,34 @@ void newRecord(FILE *fPtr)
     { // create record
         // user enters last name, first name and balance
         printf("%s", "Enter lastname, firstname, balance\n? ");
-        scanf("%14s%9s%lf", client.lastName, client.firstName, &client.balance);
+        scanf("%14s%9s%lf", client.lastName, client.firstName, &balance);
+
+        if (toCents(balance, &client.balance) != 0)
+        {
+            puts("Balance out of range.");
+            return;
+        } // end if
 
         client.acctNum = accountNum;
         // move file pointer to correct record in file
-        fseek(fPtr, (client.acctNum - 1) * sizeof(struct clientData), SEEK_SET);
+        fseek(fPtr, client.acctNum * sizeof(struct clientData), SEEK_SET);
         // insert record in file
         fwrite(&client, sizeof(struct clientData), 1, fPtr);
     } // end else
 } // end function newRecord
 
+// check an entered account number; slot 0 holds the file header, so
+// writing "account 0" would destroy it
+int validAccount(unsigned int account)
+{
+    if (account < 1 || account > MAX_ACCOUNT)
+    {
+        printf("Account number must be 1 - %d.\n", MAX_ACCOUNT);
+        return 0;
+    } // end if
+    return 1;
+} // end function validAccount
+
 // enable user to input menu choice
 unsigned int enterChoice(void)
 {
@@ -215,4 +308,199 @@ unsigned int enterChoice(void)
 
     scanf("%u", &menuChoice); // receive choice from user
     return menuChoice;
-} // end function enterChoice
\ No newline at end of file
+} // end function enterChoice
+// rewrite a headerless credit.dat (double balances) with a header and
+// balances in cents; returns 0 if the file is already converted. The new
+// file is written beside the old one and renamed over it, so a crash
+// leaves one complete file; *fPtr is then reopened on the new file.
+int convertCreditFile(FILE **fPtr)
+{
+    struct creditHeader header = {0, 0, ""}; // header read from or written to the file
+    struct clientData *records = NULL;       // every record of the old file
+    size_t count = 0;                        // number of records read
+    size_t capacity = 0;                     // allocated records
+    FILE *tmpPtr;                            // CREDIT_TEMP file pointer
+    int failed;                              // nonzero if the new file is incomplete
+
+    rewind(*fPtr);
+    if (fread(&header, sizeof(struct creditHeader), 1, *fPtr) == 1 && header.magic == CREDIT_MAGIC)
+    {
+        return 0;
+    } // end if
+
+    // read the old records; same size as the new ones, balance is a double
+    rewind(*fPtr);
+    while (1)
+    {
+        if (count == capacity)
+        {
+            size_t newCapacity = capacity ? capacity * 2 : 128;
+            struct clientData *grown = realloc(records, newCapacity * sizeof(struct clientData));
+
+            if (grown == NULL)
+            {
+                free(records);
+                return -1;
+            } // end if
+            records = grown;
+            capacity = newCapacity;
+        } // end if
+
+        if (fread(&records[count], sizeof(struct clientData), 1, *fPtr) != 1)
+        {
+            break;
+        } // end if
+
+        double balance; // old balance field
+        memcpy(&balance, &records[count].balance, sizeof(double));
+        if (toCents(balance, &records[count].balance) != 0)
+        {
+            records[count].balance = 0;
+        } // end if
+        count++;
+    } // end while
+
+    // write the header, then the records one slot further on
+    if ((tmpPtr = fopen(CREDIT_TEMP, "wb")) == NULL)
+    {
+        free(records);
+        return -1;
+    } // end if
+    memset(&header, 0, sizeof(struct creditHeader));
+    header.magic = CREDIT_MAGIC;
+    header.version = 2;
+    failed = fwrite(&header, sizeof(struct creditHeader), 1, tmpPtr) != 1 ||
+             fwrite(records, sizeof(struct clientData), count, tmpPtr) != count;
+    failed = fclose(tmpPtr) != 0 || failed;
+    free(records);
+    if (failed)
+    {
+        remove(CREDIT_TEMP);
+        return -1;
+    } // end if
+
+    // replace the old file and reopen it
+    fclose(*fPtr);
+    *fPtr = NULL;
+#ifdef _WIN32
+    remove(CREDIT_FILE); // rename() does not replace an existing file here
+#endif
+    if (rename(CREDIT_TEMP, CREDIT_FILE) != 0 || (*fPtr = fopen(CREDIT_FILE, "rb+")) == NULL)
+    {
+        return -1;
+    } // end if
+    return 0;
+} // end function convertCreditFile
+
+// convert an entered amount to cents, rounding to the nearest cent;
+// returns -1 if it is out of range
+int toCents(double amount, money_t *cents)
+{
+    double scaled = amount * MONEY_SCALE;
+
+    if (!(scaled > -(double)MONEY_LIMIT && scaled < (double)MONEY_LIMIT))
+    {
+        return -1;
+    } // end if
+    *cents = (money_t)(scaled + (scaled >= 0 ? 0.5 : -0.5));
+    return 0;
+} // end function toCents
+
+// amount in dollars, used only for printing
+double toDollars(money_t cents)
+{
+    return (double)cents / MONEY_SCALE;
+} // end function toDollars
+
+// format a record as "%-6d%-16s%-11s%10.2f\n" would, without printf
+size_t formatRecord(char *line, const struct clientData *client)
+{
+    char number[24];
+    char amount[32];
+    int acctNum = (int)client->acctNum; // printed as %d has always shown it
+    size_t numberLength = 0;
+    unsigned long long cents = client->balance < 0 ? 0ULL - (unsigned long long)client->balance
+                                                   : (unsigned long long)client->balance;
+    size_t amountLength = 0;
+    size_t length = 0;
+
+    if (acctNum < 0)
+    {
+        number[numberLength++] = '-';
+    } // end if
+    numberLength += formatNumber(number + numberLength, acctNum < 0 ? 0ULL - (unsigned long long)acctNum
+                                                                     : (unsigned long long)acctNum);
+
+    // balance: sign, whole dollars, then exactly two digits of cents
+    if (client->balance < 0)
+    {
+        amount[amountLength++] = '-';
+    } // end if
+    amountLength += formatNumber(amount + amountLength, cents / MONEY_SCALE);
+    amount[amountLength++] = '.';
+    amount[amountLength++] = (char)('0' + cents % MONEY_SCALE / 10);
+    amount[amountLength++] = (char)('0' + cents % 10);
+
+    length += formatPadded(line + length, number, numberLength, 6, 0);
+    length += formatPadded(line + length, client->lastName, fieldLength(client->lastName, sizeof(client->lastName)), 16, 0);
+    length += formatPadded(line + length, client->firstName, fieldLength(client->firstName, sizeof(client->firstName)), 11, 0);
+    length += formatPadded(line + length, amount, amountLength, 10, 1);
+    line[length++] = '\n';
+    return length;
+} // end function formatRecord
+
+// copy text padded with spaces to width, on the left if rightAlign is set
+size_t formatPadded(char *dest, const char *text, size_t length, size_t width, int rightAlign)
+{
+    size_t pad = length < width ? width - length : 0;
+
+    if (rightAlign)
+    {
+        memset(dest, ' ', pad);
+        memcpy(dest + pad, text, length);
+    } // end if
+    else
+    {
+        memcpy(dest, text, length);
+        memset(dest + length, ' ', pad);
+    } // end else
+    return length + pad;
+} // end function formatPadded
+
+// write the decimal digits of value, returning how many there are
+size_t formatNumber(char *dest, unsigned long long value)
+{
+    char digits[20];
+    size_t count = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    for (size_t i = 0; i < count; i++)
+    {
+        dest[i] = digits[count - 1 - i];
+    } // end for
+    return count;
+} // end function formatNumber
+
+// length of a name field, which is not terminated when it is full
+size_t fieldLength(const char *text, size_t size)
+{
+    const char *end = memchr(text, '\0', size);
+
+    return end != NULL ? (size_t)(end - text) : size;
+} // end function fieldLength
+
+// add amount to balance, refusing results outside the accepted range
+int addMoney(money_t *balance, money_t amount)
+{
+    if ((amount > 0 && *balance > MONEY_LIMIT - amount) ||
+        (amount < 0 && *balance < -MONEY_LIMIT - amount))
+    {
+        return -1;
+    } // end if
+    *balance += amount;
+    return 0;
+} // end function addMoney
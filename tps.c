@@ -1,87 +1,931 @@
+#ifdef __linux__
+#define _GNU_SOURCE              // copy_file_range
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <string.h>
 #include <time.h>
 
-#define MAX_ACCOUNTS 100
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#define HAVE_PTHREAD 1
+#define HAVE_FLOCK 1
+#define HAVE_UNIX_SOCKET 1
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#define HAVE_COPY_FILE_RANGE 1
+#define HAVE_REFLINK 1
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#define fsync _commit
+#endif
+
+#define MAX_ACCOUNT_NUMBER 99999999u
 #define LAST_NAME_LEN 15
 #define FIRST_NAME_LEN 10
-#define MAX_TRANSACTIONS 10
+#define LEGACY_TRANSACTIONS 10
+#ifndef HISTORY_PAGE
+#define HISTORY_PAGE 10          // transactions per history page (e.g. -DHISTORY_PAGE=64)
+#endif
+#if HISTORY_PAGE < 1
+#error HISTORY_PAGE must be at least 1
+#endif
 #define DATE_LEN 20
 
-// Transaction structure for history
+// Money is a whole number of cents, so balances and totals are exact
+typedef long long money_t;
+#define MONEY_SCALE 100
+#define MONEY_LIMIT 900000000000000000LL  // largest magnitude accepted, in cents
+
+// Transaction types recorded in the ledger
+enum transactionType { TXN_INITIAL = 1, TXN_DEPOSIT, TXN_WITHDRAW };
+
+// Transaction structure for history. The time is kept in binary and only
+// formatted when history is displayed.
 struct transaction {
-    char date[DATE_LEN];
+    long long timestamp;         // microseconds since the epoch
+    money_t amount;
+    money_t balance_after;
+    unsigned char type;          // enum transactionType
+};
+
+// History entry layout used before binary timestamps
+struct legacyTransaction {
+    char date[DATE_LEN];         // "YYYY_MM_DD_HH_MM_SS", local time
     double amount;
-    char type[10]; // "Deposit" or "Withdraw"
+    char type[10];               // "Deposit", "Withdraw" or "Initial"
     double balance_after;
 };
 
-// Enhanced structure definition
+// Enhanced structure definition. History lives in the ledger file; the
+// record only keeps the offset of the account's newest ledger entry.
 struct clientData {
+    unsigned int acctNum;
+    char lastName[LAST_NAME_LEN];
+    char firstName[FIRST_NAME_LEN];
+    money_t balance;
+    long long lastEntry;         // ledger offset, LEDGER_NONE if no history
+    int transaction_count;       // transactions ever recorded for the account
+};
+
+// Record layout used before the ledger (store version 1 and dense files)
+struct legacyClientData {
     unsigned int acctNum;
     char lastName[LAST_NAME_LEN];
     char firstName[FIRST_NAME_LEN];
     double balance;
-    struct transaction history[MAX_TRANSACTIONS];
+    struct legacyTransaction history[LEGACY_TRANSACTIONS];
     int transaction_count;
 };
 
+// Append-only transaction ledger shared by all accounts. Each entry points
+// back to the same account's previous entry, so an account's history is
+// read newest first without scanning the file. Like the other sidecar
+// files it is named after the store (clients.dat -> clients.ldg).
+#define LEDGER_EXTENSION ".ldg"
+#define LEDGER_MAGIC 0x4C535054u  // "TPSL"
+#define LEDGER_VERSION 3           // 2 kept amounts as double, 1 also stored text dates
+#define LEDGER_NONE 0             // offset 0 holds the ledger header
+
+struct ledgerHeader {
+    unsigned int magic;
+    unsigned int version;
+    long long checkedEnd;        // every transfer before this offset is in the records
+    unsigned int reserved[4];
+};
+
+struct ledgerEntry {
+    unsigned int acctNum;
+    unsigned int transferPeer;   // other account of a transfer, 0 otherwise; the
+                                 // withdrawal entry is directly followed by the deposit
+    long long prevEntry;         // previous entry of this account, LEDGER_NONE at the start
+    struct transaction txn;
+};
+
+struct legacyLedgerEntry {
+    unsigned int acctNum;
+    unsigned int reserved;
+    long long prevEntry;
+    struct legacyTransaction txn;
+};
+
+// Converting a version 1 ledger moves every entry, so the records' lastEntry
+// offsets change too. The new offsets are written to the ledger's name plus
+// LEDGER_REMAP_SUFFIX before any record is touched; while it exists the
+// conversion is resumed on open, and since it holds the new values,
+// applying it twice is harmless.
+#define LEDGER_REMAP_SUFFIX ".map"
+
+struct ledgerRemap {
+    unsigned int acctNum;
+    unsigned int reserved;
+    long long lastEntry;         // offset in the converted ledger
+};
+
+// Paged layout of clients.dat: a header followed by only the pages that
+// hold accounts. Account n lives in logical page (n-1) / RECORDS_PER_PAGE.
+#define STORE_MAGIC 0x31535054u  // "TPS1"
+#define STORE_VERSION 3            // 2 kept balances as double, 1 also embedded history
+#define RECORDS_PER_PAGE 64
+#define NO_PAGE 0xFFFFFFFFu
+#define PAGE_BYTES (sizeof(struct pageHeader) + RECORDS_PER_PAGE * sizeof(struct clientData))
+#define MAP_SPARE_PAGES 1024       // --mmap maps this many pages past the end, to grow into
+
+struct storeHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int recordSize;
+    unsigned int recordsPerPage;
+    unsigned int pageCount;      // pages present in the file (capacity)
+    unsigned int freePageHead;   // first page on the free list, NO_PAGE if empty
+    unsigned int generation;     // bumped on every open; ties the sidecar files to this file
+    unsigned int reserved[9];
+};
+
+struct pageHeader {
+    unsigned int logicalPage;    // NO_PAGE while the page is on the free list
+    unsigned int liveCount;      // accounts in use on this page
+    unsigned int nextFree;       // next page on the free list
+    unsigned int reserved;
+};
+
+// Trigram name index kept in clients.idx: for every three-character
+// sequence of a lowercased last or first name, the sorted account numbers
+// whose names contain it. The file holds a snapshot followed by a log of
+// adds and removes that is replayed on open.
+#define NAME_INDEX_EXTENSION ".idx"
+#define NAME_INDEX_MAGIC 0x49535054u  // "TPSI"
+#define NAME_INDEX_VERSION 1
+#define NAME_INDEX_COMPACT_EVERY 4096
+#define NAME_INDEX_ADD 1
+#define NAME_INDEX_REMOVE 2
+
+struct nameIndexHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int trigramCount;   // posting lists in the snapshot
+    unsigned int accountCount;   // accounts indexed by the snapshot
+    unsigned int generation;     // storeHeader.generation of the session that wrote it
+    unsigned int reserved[3];
+};
+
+struct nameIndexDelta {
+    unsigned int op;             // NAME_INDEX_ADD or NAME_INDEX_REMOVE
+    unsigned int acctNum;
+    char lastName[LAST_NAME_LEN];
+    char firstName[FIRST_NAME_LEN];
+};
+
+struct postingList {
+    unsigned int trigram;        // 0 marks an empty table slot
+    unsigned int count;
+    unsigned int capacity;
+    unsigned int *accounts;      // ascending account numbers
+};
+
+struct nameIndex {
+    struct postingList *lists;   // open-addressing table keyed by trigram
+    size_t tableSize;
+    size_t used;
+    unsigned int accountCount;
+    unsigned int pendingDeltas;  // log entries since the last snapshot
+    unsigned int generation;     // written to the snapshot header
+    const char *fileName;        // the store's indexName
+    FILE *logPtr;
+    int loaded;
+};
+
+// Columnar copy of the balances, kept in clients.col: one balance per
+// physical record slot and one active bit per slot (a 64-bit word per
+// page), so summaries never read the records themselves. The file is
+// marked clean only on close and rebuilt from clients.dat otherwise.
+#define COLUMN_EXTENSION ".col"
+#define COLUMN_MAGIC 0x43535054u  // "TPSC"
+#define COLUMN_VERSION 1
+
+struct columnHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int pageCount;
+    unsigned int generation;     // storeHeader.generation when written
+    unsigned int clean;          // 1 if written on close, 0 while in use
+    unsigned int reserved[3];
+};
+
+struct balanceColumns {
+    money_t *balances;           // [page * RECORDS_PER_PAGE + slot]
+    unsigned long long *active;  // [page], bit slot set if the slot holds an account
+    unsigned int pageCount;      // pages the arrays cover
+    int loaded;
+};
+
+// Result of summarizeBalances
+struct balanceSummary {
+    unsigned long count;
+    money_t total;
+    int overflow;                // total does not fit in money_t
+    money_t highest, lowest;
+    unsigned int highestAcct, lowestAcct;
+};
+
+// Partial result of summarizeBalances for one range of pages
+struct summaryChunk {
+    struct balanceSummary summary;   // count and extremes (total is set at the end)
+    long long highSum, lowSum;
+    int found;
+};
+
+struct summaryScan {
+    const struct balanceColumns *columns;
+    const struct pageHeader *pages;
+    struct summaryChunk result;      // chunks merged so far
+};
+
+// Parallel scan: items [0, itemCount) are split into chunks that worker
+// threads claim in turn. Every chunk fills its own zeroed partial result,
+// and the partials are merged in chunk order after all workers finish, so
+// the outcome does not depend on the thread count or on scheduling.
+#define SCAN_MAX_THREADS 64
+#define SCAN_CHUNKS_PER_THREAD 4   // smaller chunks even out uneven pages
+#define COPY_BLOCK (1 << 16)       // bytes per read when copying files
+
+struct scanJob {
+    void (*scanChunk)(struct scanJob *job, size_t begin, size_t end, void *partial);
+    void (*mergeChunk)(struct scanJob *job, void *partial);
+    size_t partialSize;
+    void *context;               // operation state, read-only while chunks run
+    size_t itemCount;
+    size_t chunkSize;
+    size_t chunkCount;
+    size_t nextChunk;            // next chunk to claim
+    unsigned char *partials;     // chunkCount * partialSize bytes
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;        // guards nextChunk
+#endif
+};
+
+// Record scan shared by the export and the name search
+struct recordScan {
+    struct accountStore *store;
+    const char *term;            // lowercased search term, NULL to list every account
+    int format;                  // enum exportFormat (export only)
+    FILE *out;                   // where the lines go (export only)
+    struct recordArray *matches; // collects the matching records (search only)
+    unsigned long lines;
+    int failed;
+};
+
+// Matching records of a name search, whole or one chunk's share
+struct recordArray {
+    struct clientData *records;
+    size_t count;
+    size_t capacity;
+    int status;                  // ACCOUNT_OK, or why the scan stopped early
+};
+
+// Account listing formats (option 1 and --export). Lines are built by
+// the hand-written formatters below rather than printf, which dominated
+// the cost of large exports.
+enum exportFormat { EXPORT_FIXED, EXPORT_CSV, EXPORT_JSONL, EXPORT_FORMATS };
+#define EXPORT_LINE_MAX 256        // longest line of any format (JSON escapes included)
+#define EXPORT_BUFFER (1 << 20)    // stdio buffer of the export file
+
+// Output of one chunk of a record scan (export or search)
+struct textBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+    unsigned long lines;
+    int failed;                  // a page could not be read or memory ran out
+};
+
+// Incremental backups: every write to clients.dat marks its physical page
+// dirty. A full backup copies the whole file; an incremental one holds
+// only the pages marked since the previous backup, plus the ledger entries
+// appended since then, and names that backup as its parent, so a restore
+// replays the full backup and then each increment in order. The marks are
+// kept in clients.bkp between runs; after an unclean exit they cannot be
+// trusted and the next backup is a full one.
+#define BACKUP_STATE_EXTENSION ".bkp"
+#define BACKUP_MAGIC 0x42535054u     // "TPSB"
+#define INCREMENT_MAGIC 0x44535054u  // "TPSD", first word of an incremental backup
+#define BACKUP_VERSION 1
+#define BACKUP_NAME_LEN 64
+#define BACKUP_CHAIN_MAX 256         // increments replayed by one restore
+
+struct backupStateHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int generation;     // storeHeader.generation when written
+    unsigned int clean;          // 1 if written on close, 0 while in use
+    unsigned int pageCount;      // dirty marks that follow, one byte per page
+    unsigned int reserved[3];
+    long long ledgerSize;        // ledger bytes covered by the last backup
+    char lastBackup[BACKUP_NAME_LEN];  // newest backup, "" if there is no usable one
+};
+
+// Incremental backup file (.inc): this header, then dirtyCount pairs of a
+// physical page number and the page's PAGE_BYTES. Ledger bytes
+// [ledgerStart, ledgerEnd) go to the companion .ldg file.
+struct incrementHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int dirtyCount;
+    unsigned int reserved;
+    long long ledgerStart;
+    long long ledgerEnd;
+    char parent[BACKUP_NAME_LEN];    // backup this one applies on top of
+    struct storeHeader store;        // clients.dat header at backup time
+};
+
+struct backupState {
+    unsigned char *dirty;        // [physical page], nonzero if written since the last backup
+    unsigned int pageCount;      // pages the marks cover
+    long long ledgerSize;
+    char lastBackup[BACKUP_NAME_LEN];
+    int loaded;
+};
+
+// Online backup: a full backup copied by a background thread while updates
+// go on. Before a page the thread has not reached is changed, the writer
+// copies the page as it still is into the backup, so the backup holds
+// every page as of the moment it started and a writer waits for at most
+// one page copy.
+struct onlineBackup {
+    char name[BACKUP_NAME_LEN];
+    char ledgerName[BACKUP_NAME_LEN];
+    char sourceLedger[FILENAME_MAX]; // the store's ledger, copied up to ledgerSize
+    struct storeHeader header;       // clients.dat header when the backup started
+    long long ledgerSize;            // ledger bytes when the backup started
+    unsigned char *copied;           // [page < header.pageCount] already in the backup
+    FILE *source;                    // clients.dat, read for page images
+    FILE *out;
+    unsigned int pagesPreserved;     // pages copied by writers ahead of the thread
+    int active;                      // started and not yet collected; changed only while
+                                     // no writer can run (menu loop, all server stripes)
+    int finished;
+    int failed;
+#ifdef HAVE_PTHREAD
+    pthread_t thread;
+    pthread_mutex_t lock;            // copied[], source, out and the fields below active
+#endif
+};
+
+// Group commit: completed transactions are queued and made durable
+// together, with one flush and fsync of the ledger and clients.dat once
+// commitEvery are waiting or the oldest has waited commitMicros. A
+// flusher thread does the syncing; callers that need durability (a menu
+// update, a server reply) wait for the fsync covering their ticket; a
+// lone writer with nothing else queued is synced without the timer.
+#define COMMIT_EVERY_DEFAULT 32
+#define COMMIT_MICROS_DEFAULT 2000
+#define COMMIT_BUCKETS 24            // log2 histogram buckets
+
+struct commitPipeline {
+    unsigned long long enqueued;     // tickets handed out
+    unsigned long long durable;      // tickets covered by a completed fsync
+    long long *waiting;              // enqueue times (microseconds) not yet synced
+    size_t waitingCount;
+    size_t waitingCapacity;
+    unsigned long long batches;
+    unsigned long long latency[COMMIT_BUCKETS];    // per transaction, enqueue to durable, log2 us
+    unsigned long long batchSize[COMMIT_BUCKETS];  // per fsync, log2 transactions
+    int running;                     // 1 with a flusher thread, -1 syncing inline, 0 off
+    int flushRequests;               // callers that want a sync without the batch timer
+    int waiters;                     // callers waiting in commitWait
+#ifdef HAVE_PTHREAD
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;             // flusher: a batch filled up or shutdown
+    pthread_cond_t synced;           // waiters: durable moved forward
+#endif
+};
+
+// Storage backend for clients.dat: buffered stdio (default) or a shared
+// memory mapping that hands out record pointers directly (--mmap)
+struct accountStore {
+    FILE *fp;
+    const char *fileName;        // path given to storeOpen; scans open their own handles
+    char ledgerName[FILENAME_MAX];   // sidecar files, named after fileName
+    char indexName[FILENAME_MAX];
+    char columnName[FILENAME_MAX];
+    char backupStateName[FILENAME_MAX];
+    unsigned char *map;          // mapped file, NULL for the stdio backend
+    size_t mapLength;            // mapped bytes: the file plus room for MAP_SPARE_PAGES
+    int useMmap;
+    long filePos;                // stdio read position, -1 if unknown
+    struct storeHeader header;
+    unsigned int openGeneration; // header.generation as found; the open bumps it
+    struct pageHeader *pages;    // in-memory copy of every page header
+    unsigned int *directory;     // logical page -> physical page, NO_PAGE if absent
+    size_t directorySize;
+    FILE *ledgerPtr;             // transaction ledger, appended at ledgerEnd
+    long long ledgerEnd;
+    long long ledgerChecked;     // ledgerHeader.checkedEnd
+    struct nameIndex names;      // loaded by nameIndexOpen for interactive use
+    struct balanceColumns columns;
+    struct backupState backup;
+    struct onlineBackup online;
+    struct commitPipeline commits;
+    int openMode;                // STORE_* flags given to storeOpenMode
+};
+
+// storeOpenMode flags for the temporary store convertLegacyFile writes
+#define STORE_CONVERTING 1       // leave the balance columns and backup state alone
+#define STORE_DEFER_LEDGER 2     // do not convert an older ledger: the records being
+                                 // copied point into it, so the real store does that
+
+// Results of the account operations (accountGet, accountPost, ...). They
+// take every input as an argument and never prompt or print; the menu,
+// --bench and the server's BALANCE call them. Server updates and --apply
+// use the storage primitives directly, to lock per stripe and to group
+// many changes into one commit.
+enum accountStatus {
+    ACCOUNT_OK,
+    ACCOUNT_BAD_NUMBER,          // outside 1 - MAX_ACCOUNT_NUMBER
+    ACCOUNT_NOT_FOUND,
+    ACCOUNT_EXISTS,
+    ACCOUNT_OUT_OF_RANGE,        // the balance would leave the money range
+    ACCOUNT_NO_SPACE,            // no page could be allocated for the account
+    ACCOUNT_NO_MEMORY,
+    ACCOUNT_IO_ERROR,            // some records could not be read
+    ACCOUNT_LEDGER_ERROR         // applied, but the history entry was not written
+                                 // (accountCreate: not applied at all)
+};
+
+// Account API prototypes
+int accountGet(struct accountStore *store, unsigned int account, struct clientData *client);
+int accountPost(struct accountStore *store, unsigned int account, money_t amount, money_t *balance);
+int accountCreate(struct accountStore *store, const struct clientData *client);
+int accountDelete(struct accountStore *store, unsigned int account);
+int accountSearch(struct accountStore *store, const char *term, struct clientData **matches, size_t *count);
+int accountSummary(struct accountStore *store, struct balanceSummary *summary);
+
 // Function prototypes - Original functions
 unsigned int enterChoice(void);
-void createTextFile(FILE *readPtr);
-void updateRecord(FILE *fPtr);
-void addAccount(FILE *fPtr);
-void deleteAccount(FILE *fPtr);
-void displayAccount(FILE *fPtr);
+void createTextFile(struct accountStore *store);
+void updateRecord(struct accountStore *store);
+void addAccount(struct accountStore *store);
+void deleteAccount(struct accountStore *store);
+void displayAccount(struct accountStore *store);
 void clearInputBuffer(void);
 
 // New function prototypes
-void searchAccountByName(FILE *fPtr);
-void viewTransactionHistory(FILE *fPtr);
-void generateAccountSummary(FILE *fPtr);
-void backupAccounts(FILE *fPtr);
-void restoreBackup(FILE **fPtr);
-void addTransaction(struct clientData *client, double amount, const char* type);
+void searchAccountByName(struct accountStore *store);
+void viewTransactionHistory(struct accountStore *store);
+void generateAccountSummary(struct accountStore *store);
+void backupAccounts(struct accountStore *store);
+void restoreBackup(struct accountStore *store);
+void restoreDropHistory(struct accountStore *store);
+int addTransaction(struct accountStore *store, struct clientData *client, money_t amount, unsigned char type);
+int moneyFromDouble(double value, money_t *money);
+double moneyToDouble(money_t money);
+money_t moneyFromStoredDouble(money_t bits);
+int moneyAdd(money_t *value, money_t delta);
+long long currentTimestamp(void);
+void formatTimestamp(long long timestamp, char *text, size_t size);
+const char *transactionTypeName(unsigned char type);
 void getCurrentDateTime(char *dateTime);
 
+// Storage backend prototypes
+int storeOpen(struct accountStore *store, const char *fileName, int useMmap);
+int storeOpenMode(struct accountStore *store, const char *fileName, const char *sidecarName,
+                  int useMmap, int mode);
+void storeClose(struct accountStore *store);
+struct clientData *fetchRecord(struct accountStore *store, unsigned int account, struct clientData *buffer);
+struct clientData *fetchRecordForUpdate(struct accountStore *store, unsigned int account, struct clientData *buffer);
+int commitRecord(struct accountStore *store, unsigned int account, struct clientData *client);
+int insertRecord(struct accountStore *store, struct clientData *client);
+int removeRecord(struct accountStore *store, unsigned int account);
+struct clientData *nextRecord(struct accountStore *store, unsigned int *account, struct clientData *buffer);
+void storeSync(struct accountStore *store);
+unsigned long storeCapacity(const struct accountStore *store);
+unsigned long storeAccountCount(const struct accountStore *store);
+long pageOffset(unsigned int page);
+long recordOffset(const struct accountStore *store, unsigned int account);
+int setDirectoryEntry(struct accountStore *store, unsigned int logicalPage, unsigned int page);
+unsigned int allocatePage(struct accountStore *store, unsigned int logicalPage);
+void writeStoreBytes(struct accountStore *store, long offset, const void *data, size_t size);
+void writeStoreHeader(struct accountStore *store);
+void writePageHeader(struct accountStore *store, unsigned int page);
+int storeMap(struct accountStore *store);
+void storeUnmap(struct accountStore *store);
+int storeRemap(struct accountStore *store);
+int convertLegacyFile(const char *fileName);
+int convertLegacyRecord(struct accountStore *store, const struct legacyClientData *legacy);
+int ledgerOpen(struct accountStore *store);
+int convertLegacyLedger(struct accountStore *store, unsigned int version);
+int ledgerRemapRecords(struct accountStore *store);
+void convertLegacyTransaction(const struct legacyTransaction *legacy, struct transaction *txn);
+int ledgerAppend(struct accountStore *store, struct clientData *client, const struct transaction *txn);
+int ledgerAppendTransfer(struct accountStore *store, struct clientData *from, struct clientData *to,
+                         money_t amount);
+int ledgerRead(struct accountStore *store, long long offset, struct ledgerEntry *entry);
+int ledgerRecover(struct accountStore *store);
+int ledgerMarkChecked(struct accountStore *store);
+void companionName(char *dest, size_t size, const char *dataName, const char *extension);
+int copyFileBlocks(FILE *from, FILE *to);
+int syncFileName(const char *name);
+
+// Balance column prototypes
+void columnsOpen(struct accountStore *store);
+void columnsSave(struct accountStore *store, int clean);
+int columnsReserve(struct balanceColumns *columns, unsigned int pageCount);
+void columnsUpdate(struct accountStore *store, unsigned int account, const struct clientData *client);
+void summarizeBalances(const struct balanceColumns *columns, const struct pageHeader *pages,
+                       struct balanceSummary *summary);
+unsigned int countBits(unsigned long long word);
+
+// Backup prototypes
+void backupStateOpen(struct accountStore *store);
+void backupStateSave(struct accountStore *store, int clean);
+int backupReserve(struct backupState *backup, unsigned int pageCount);
+void backupMarkDirty(struct accountStore *store, long offset, size_t size);
+void backupReset(struct accountStore *store, const char *lastBackup);
+int writeIncrement(struct accountStore *store, const char *name, const char *ledgerName,
+                   unsigned int *pagesWritten);
+int backupChain(const char *name, char chain[][BACKUP_NAME_LEN], int max);
+int applyIncrement(const char *name, const char *dataName, const char *ledgerName);
+void backupFileName(char *name, size_t size, const char *prefix, const char *extension);
+int onlineBackupStart(struct accountStore *store, const char *name, const char *ledgerName);
+void *onlineBackupWorker(void *arg);
+int onlineBackupCopyPage(struct onlineBackup *online, unsigned int page);
+void onlineBackupPreserve(struct accountStore *store, long offset, size_t size);
+int onlineBackupFinish(struct accountStore *store, int wait);
+
+// Group commit prototypes
+void commitStart(struct accountStore *store);
+void commitStop(struct accountStore *store);
+unsigned long long commitEnqueue(struct accountStore *store);
+void commitWait(struct accountStore *store, unsigned long long ticket);
+void commitFlush(struct accountStore *store);
+void commitReport(struct accountStore *store);
+void commitBatch(struct accountStore *store, long long *times, size_t count);
+void *commitFlusher(void *arg);
+unsigned int log2Bucket(unsigned long long value);
+#ifdef HAVE_PTHREAD
+int startThread(pthread_t *thread, void *(*start)(void *), void *arg);
+#endif
+
+// Parallel scan prototypes
+int parallelScan(struct scanJob *job, size_t itemCount);
+void *scanWorker(void *arg);
+unsigned int scanThreadCount(void);
+int scanRecords(struct accountStore *store, const char *term, int format, FILE *out, unsigned long *lines);
+int runRecordScan(struct recordScan *scan);
+void scanRecordChunk(struct scanJob *job, size_t begin, size_t end, void *partial);
+void mergeRecordChunk(struct scanJob *job, void *partial);
+int runSearchScan(struct recordScan *scan);
+void searchRecordChunk(struct scanJob *job, size_t begin, size_t end, void *partial);
+void mergeSearchChunk(struct scanJob *job, void *partial);
+int recordAppend(struct recordArray *array, const struct clientData *client);
+const struct clientData *scanPageRecords(struct accountStore *store, unsigned int logicalPage,
+                                         FILE **fp, struct clientData *records);
+int textAppend(struct textBuffer *text, const char *line, size_t length);
+void summarizeChunk(struct scanJob *job, size_t begin, size_t end, void *partial);
+void mergeSummaryChunk(struct scanJob *job, void *partial);
+
+// Export prototypes
+int exportAccounts(struct accountStore *store, int format, int verbose);
+int parseExportFormat(const char *name);
+size_t formatRecord(char *line, const struct clientData *client, int format);
+size_t formatUnsigned(char *dest, unsigned long long value);
+size_t formatMoney(char *dest, money_t cents);
+size_t formatPadded(char *dest, const char *text, size_t length, size_t width, int rightAlign);
+size_t formatCsvField(char *dest, const char *text, size_t length);
+size_t formatJsonString(char *dest, const char *text, size_t length);
+size_t fieldLength(const char *text, size_t size);
+
+// Name index prototypes
+void nameIndexOpen(struct accountStore *store);
+void nameIndexRebuild(struct accountStore *store);
+void nameIndexRecord(struct accountStore *store, const struct clientData *client, int adding);
+unsigned int *nameIndexCandidates(struct nameIndex *index, const char *term, size_t *count);
+void nameIndexSave(struct nameIndex *index);
+void nameIndexClose(struct nameIndex *index);
+void nameIndexClear(struct nameIndex *index);
+void nameIndexUpdate(struct nameIndex *index, const struct clientData *client, int adding);
+struct postingList *postingListFor(struct nameIndex *index, unsigned int trigram, int create);
+int postingFind(const struct postingList *list, unsigned int account, size_t *pos);
+unsigned int trigramKey(const char *text);
+void lowercaseCopy(char *dest, const char *src, size_t size);
+int nameMatches(const struct clientData *client, const char *term);
+
+// Batch mode prototypes
+int applyTransactionFile(struct accountStore *store, const char *fileName);
+int comparePendingTxn(const void *a, const void *b);
+double elapsedSeconds(long long started);
+
+// Pending entry read from a batch transaction file
+struct pendingTxn {
+    unsigned int acctNum;
+    unsigned int seq;   // position in the input file, keeps per-account order
+    money_t amount;
+};
+
+// Benchmark (--bench): a synthetic workload run against a fresh store,
+// calling the same storage functions as the menu. Operations are chosen
+// by weight and accounts by a Zipfian distribution, both from a seeded
+// generator, so a run can be repeated exactly.
+enum benchOp { BENCH_DEPOSIT, BENCH_WITHDRAW, BENCH_LOOKUP, BENCH_SEARCH, BENCH_SUMMARY, BENCH_OPS };
+
+#define BENCH_ACCOUNTS_DEFAULT 100000
+#define BENCH_SKEW_DEFAULT 0.99      // Zipf exponent; 0 is uniform
+#define BENCH_SEED_DEFAULT 1
+
+struct benchConfig {
+    unsigned long operations;
+    unsigned long accounts;
+    double skew;
+    unsigned int mix[BENCH_OPS];     // relative weights, in benchOp order
+    unsigned long long seed;
+};
+
+// Zipfian ranks 1..n, rank 1 the most frequent (Gray et al., "Quickly
+// Generating Billion-Record Synthetic Databases")
+struct zipfGenerator {
+    unsigned long n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+};
+
+// Benchmark prototypes
+int runBenchmark(const struct benchConfig *config, int useMmap);
+int benchPopulate(struct accountStore *store, const struct benchConfig *config);
+long long benchOperation(struct accountStore *store, int op, unsigned int account,
+                         const struct benchConfig *config, unsigned long long *random);
+void benchLastName(char *dest, unsigned int account, unsigned long long seed);
+void benchReport(const struct benchConfig *config, int useMmap, double populateSeconds, double seconds,
+                 const unsigned char *ops, const long long *latencies);
+int parseBenchMix(const char *text, unsigned int *mix);
+unsigned long long benchRandom(unsigned long long *state);
+void zipfInit(struct zipfGenerator *zipf, unsigned long n, double theta);
+unsigned long zipfNext(const struct zipfGenerator *zipf, unsigned long long *random);
+int compareLatency(const void *a, const void *b);
+
+// Metrics: counts, bytes and latency histograms for the hot paths. Every
+// thread records into a block of its own, so recording takes no lock; a
+// dump (SIGUSR1, or STATS on the server) adds the blocks up. Buckets are
+// HDR-style: exact below 16 ns, then 8 per power of two (within 12.5%).
+enum metricOp {
+    METRIC_READ,                 // fetchRecord; a hit needs no fseek (mapping or sequential)
+    METRIC_WRITE,                // writeStoreBytes
+    METRIC_SEEK,                 // fseek on clients.dat
+    METRIC_FSYNC,                // one group commit's fsyncs
+    METRIC_LEDGER,               // ledgerAppend
+    METRIC_LOOKUP,               // accountGet, BALANCE
+    METRIC_POST,                 // accountPost (option 2), DEPOSIT/WITHDRAW
+    METRIC_SEARCH,               // accountSearch; a hit is answered by the name index
+    METRIC_OPS
+};
+
+#define METRIC_LINEAR 16
+#define METRIC_SUB_BUCKETS 8
+#define METRIC_BUCKETS (METRIC_LINEAR + (64 - 4) * METRIC_SUB_BUCKETS)
+#define METRIC_UNTIMED -1LL      // nanos value for an operation counted but not timed
+
+// Counter fields have one writer each and are read by the dump: relaxed
+// atomic accesses with threads, plain ones without
+#ifdef HAVE_PTHREAD
+#define METRIC_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define METRIC_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#else
+#define METRIC_STORE(field, value) ((field) = (value))
+#define METRIC_LOAD(field) (field)
+#endif
+#define METRICS_TEXT_MAX 4096    // longest metrics dump (one JSON line)
+
+struct metricCounters {
+    unsigned long long count;
+    unsigned long long bytes;
+    unsigned long long hits;
+    unsigned long long timed;    // operations with a latency in the histogram
+    unsigned long long totalNanos;
+    unsigned long long maxNanos;
+    unsigned long long buckets[METRIC_BUCKETS];
+};
+
+// Written only by the owning thread, with relaxed atomic stores so the
+// dump may read it at any time. A block outlives its thread and is handed
+// to the next new thread, keeping its counts.
+struct metricsBlock {
+    struct metricCounters ops[METRIC_OPS];
+    struct metricsBlock *next;
+    int inUse;                   // guarded by metricsLock
+};
+
+// Metrics prototypes
+void metricsStart(void);
+long long metricsNow(void);
+void metricsRecord(int op, long long nanos, size_t bytes, int hit);
+struct metricsBlock *metricsLocal(void);
+unsigned int metricsBucket(unsigned long long nanos);
+unsigned long long metricsBucketLimit(unsigned int bucket);
+size_t metricsFormat(char *dest, size_t size);
+
+#ifdef HAVE_UNIX_SOCKET
+// Transaction server (--serve): one thread per connection, each request a
+// single text line. Records are changed in place in the mapping under a
+// lock striped by logical page, so requests on accounts in different
+// pages run in parallel; the page (not the account) is the unit because
+// accounts on one page share a word of the balance columns.
+#define SERVER_LOCK_STRIPES 256
+#define SERVER_MAX_CLIENTS 256
+#define SERVER_REPLY_MAX (METRICS_TEXT_MAX + 8)   // longest reply line (STATS)
+
+struct transactionServer {
+    struct accountStore *store;
+    pthread_mutex_t stripes[SERVER_LOCK_STRIPES];
+    pthread_mutex_t ledgerLock;  // ledger append position and stdio buffer
+    pthread_mutex_t lock;        // connection table and counters below
+    pthread_cond_t idle;         // signalled when the last connection ends
+    int clients[SERVER_MAX_CLIENTS];   // connected sockets, -1 if free
+    unsigned int active;
+    unsigned long requests;
+};
+
+struct serverConnection {
+    struct transactionServer *server;
+    int fd;
+    int slot;
+};
+
+int runServer(struct accountStore *store, const char *socketPath);
+void *serveConnection(void *arg);
+int handleRequest(struct transactionServer *server, char *line, char *reply, size_t size);
+const char *serverPost(struct transactionServer *server, unsigned int account, money_t amount, money_t *balance);
+const char *serverTransfer(struct transactionServer *server, unsigned int from, unsigned int to,
+                           money_t amount, money_t *fromBalance, money_t *toBalance);
+pthread_mutex_t *serverStripe(struct transactionServer *server, unsigned int account);
+void stopServer(int signum);
+
+static volatile sig_atomic_t serverStopping = 0;
+#endif
+
+// Group commit limits (--sync-every, --sync-usec); commitEvery 0 disables fsync
+static unsigned int commitEvery = COMMIT_EVERY_DEFAULT;
+static long long commitMicros = COMMIT_MICROS_DEFAULT;
+
+// Worker threads for full scans (--threads), 0 = one per online processor
+static unsigned int scanThreads = 0;
+
+// Metrics blocks of every thread that has recorded anything
+static struct metricsBlock *metricsBlocks = NULL;
+static long long metricsStarted = 0;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t metricsKey;
+static __thread struct metricsBlock *metricsMine = NULL;
+void metricsRelease(void *block);
+void *metricsSignalWaiter(void *arg);
+#endif
+
 // Main function
-int main(void) {
-    FILE *cfPtr;
+int main(int argc, char *argv[]) {
+    struct accountStore store;
     unsigned int choice;
+    const char *applyFile = NULL;
+    const char *socketPath = NULL;
+    int useMmap = 0;
+    int rebuildIndex = 0;
+    int exportFormat = -1;
+    struct benchConfig bench = {0, BENCH_ACCOUNTS_DEFAULT, BENCH_SKEW_DEFAULT, {40, 30, 25, 4, 1}, BENCH_SEED_DEFAULT};
 
-    if ((cfPtr = fopen("clients.dat", "rb+")) == NULL) {
-        puts("File could not be opened. Creating a new file...");
-        cfPtr = fopen("clients.dat", "wb+");
-
-        if (cfPtr == NULL) {
-            puts("Error: Could not create clients.dat");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mmap") == 0) {
+            useMmap = 1;
+        } else if (strcmp(argv[i], "--apply") == 0 && i + 1 < argc) {
+            applyFile = argv[++i];
+        } else if (strcmp(argv[i], "--rebuild-index") == 0) {
+            rebuildIndex = 1;
+        } else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc &&
+                   (exportFormat = parseExportFormat(argv[i + 1])) >= 0) {
+            i++;
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            bench.operations = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--bench-accounts") == 0 && i + 1 < argc) {
+            bench.accounts = strtoul(argv[++i], NULL, 10);
+            if (bench.accounts < 1 || bench.accounts > MAX_ACCOUNT_NUMBER) {
+                printf("Error: --bench-accounts takes a value from 1 to %u\n", MAX_ACCOUNT_NUMBER);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--bench-skew") == 0 && i + 1 < argc) {
+            bench.skew = strtod(argv[++i], NULL);
+            if (!(bench.skew >= 0 && bench.skew < 1)) {
+                puts("Error: --bench-skew takes a value from 0 (uniform) up to, not including, 1");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--bench-mix") == 0 && i + 1 < argc) {
+            if (parseBenchMix(argv[++i], bench.mix) != 0) {
+                puts("Error: --bench-mix takes deposit,withdraw,lookup,search,summary weights, e.g. 40,30,25,4,1");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            bench.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (strcmp(argv[i], "--sync-every") == 0 && i + 1 < argc) {
+            commitEvery = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--sync-usec") == 0 && i + 1 < argc) {
+            commitMicros = strtoll(argv[++i], NULL, 10);
+            if (commitMicros < 0) commitMicros = 0;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            scanThreads = (unsigned int)strtoul(argv[++i], NULL, 10);
+            if (scanThreads < 1 || scanThreads > SCAN_MAX_THREADS) {
+                printf("Error: --threads takes a value from 1 to %d\n", SCAN_MAX_THREADS);
+                return EXIT_FAILURE;
+            }
+        } else {
+            printf("Usage: %s [--mmap] [--threads <1-%d>] [--apply <transactions.csv>] [--rebuild-index]\n"
+                   "       [--export <text|csv|jsonl>] [--serve <socket>] [--sync-every <n>] [--sync-usec <microseconds>]\n"
+                   "       [--bench <operations> [--bench-accounts <n>] [--bench-skew <0-1>] [--bench-mix <d,w,l,s,s>] [--seed <n>]]\n",
+                   argv[0], SCAN_MAX_THREADS);
             return EXIT_FAILURE;
         }
+    }
+
+    // Counters for the hot paths; kill -USR1 <pid> prints them to stderr
+    metricsStart();
+
+    // Synthetic workload on a scratch store: tps --bench 100000
+    if (bench.operations > 0) {
+        return runBenchmark(&bench, useMmap);
+    }
+
+    // The server changes records in place, so it always maps the file
+    if (storeOpen(&store, "clients.dat", useMmap || socketPath != NULL) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    // Long-running server: tps --serve /tmp/tps.sock
+    if (socketPath != NULL) {
+#ifdef HAVE_UNIX_SOCKET
+        int status = runServer(&store, socketPath);
+#else
+        int status = EXIT_FAILURE;
+        puts("Error: --serve is not available on this platform.");
+#endif
+        storeClose(&store);
+        return status;
+    }
+
+    // Non-interactive batch mode: tps --apply txns.csv
+    if (applyFile != NULL) {
+        int status = applyTransactionFile(&store, applyFile);
+        storeClose(&store);
+        return status;
+    }
+
+    // Non-interactive export: tps --export csv
+    if (exportFormat >= 0) {
+        int status = exportAccounts(&store, exportFormat, 1);
+        storeClose(&store);
+        return status == 0 ? 0 : EXIT_FAILURE;
+    }
 
-        // Initialize file with blank records
-        struct clientData blankClient = {0, "", "", 0.0, {}, 0};
-        for (int i = 0; i < MAX_ACCOUNTS; ++i)
-            fwrite(&blankClient, sizeof(struct clientData), 1, cfPtr);
+    // Offline maintenance: tps --rebuild-index
+    if (rebuildIndex) {
+        nameIndexRebuild(&store);
+        printf("Name index rebuilt for %lu accounts.\n", storeAccountCount(&store));
+        storeClose(&store);
+        return 0;
     }
 
+    nameIndexOpen(&store);
+
     while ((choice = enterChoice()) != 11) { // Updated exit option
+        onlineBackupFinish(&store, 0);
         switch (choice) {
-            case 1: createTextFile(cfPtr); break;
-            case 2: updateRecord(cfPtr); break;
-            case 3: addAccount(cfPtr); break;
-            case 4: deleteAccount(cfPtr); break;
-            case 5: displayAccount(cfPtr); break;
-            case 6: searchAccountByName(cfPtr); break;          // NEW FEATURE
-            case 7: viewTransactionHistory(cfPtr); break;       // NEW FEATURE
-            case 8: generateAccountSummary(cfPtr); break;       // NEW FEATURE
-            case 9: backupAccounts(cfPtr); break;               // NEW FEATURE
-            case 10: restoreBackup(&cfPtr); break;              // NEW FEATURE
+            case 1: createTextFile(&store); break;
+            case 2: updateRecord(&store); break;
+            case 3: addAccount(&store); break;
+            case 4: deleteAccount(&store); break;
+            case 5: displayAccount(&store); break;
+            case 6: searchAccountByName(&store); break;          // NEW FEATURE
+            case 7: viewTransactionHistory(&store); break;       // NEW FEATURE
+            case 8: generateAccountSummary(&store); break;       // NEW FEATURE
+            case 9: backupAccounts(&store); break;               // NEW FEATURE
+            case 10: restoreBackup(&store); break;               // NEW FEATURE
             default: puts("Invalid choice. Try again."); break;
         }
     }
 
-    fclose(cfPtr);
+    storeClose(&store);
     puts("Program ended.");
     return 0;
 }
@@ -115,89 +959,138 @@ void clearInputBuffer(void) {
 }
 
 // Create a text file from binary
-void createTextFile(FILE *readPtr) {
-    FILE *writePtr;
-    struct clientData client;
+void createTextFile(struct accountStore *store) {
+    unsigned int format = 0;
 
-    if ((writePtr = fopen("accounts.txt", "w")) == NULL) {
-        puts("Could not open accounts.txt for writing.");
+    printf("Export format - 1 printable text, 2 CSV, 3 JSON Lines: ");
+    scanf("%u", &format);
+    clearInputBuffer();
+    if (format < 1 || format > EXPORT_FORMATS) {
+        puts("Invalid export format.");
         return;
     }
+    exportAccounts(store, (int)format - 1, 0);
+}
 
-    rewind(readPtr);
-    fprintf(writePtr, "%-6s%-16s%-11s%10s\n", "Acct", "Last Name", "First Name", "Balance");
+// Export every account to accounts.txt, accounts.csv or accounts.jsonl.
+// Pages are formatted in parallel and written in account order, a chunk
+// at a time, through a large buffer.
+int exportAccounts(struct accountStore *store, int format, int verbose) {
+    static const char *fileNames[EXPORT_FORMATS] = {"accounts.txt", "accounts.csv", "accounts.jsonl"};
+    long long started;
+    FILE *writePtr;
+    char *buffer;
+    unsigned long lines = 0;
+    long bytes;
+    int status = 0;
 
-    while (fread(&client, sizeof(struct clientData), 1, readPtr) == 1) {
-        if (client.acctNum != 0) {
-            fprintf(writePtr, "%-6u%-16s%-11s%10.2f\n",
-                    client.acctNum, client.lastName, client.firstName, client.balance);
-        }
+    if ((writePtr = fopen(fileNames[format], "w")) == NULL) {
+        printf("Could not open %s for writing.\n", fileNames[format]);
+        return -1;
     }
+    if ((buffer = malloc(EXPORT_BUFFER)) != NULL) {
+        setvbuf(writePtr, buffer, _IOFBF, EXPORT_BUFFER);
+    }
+    started = metricsNow();
+
+    if (format == EXPORT_FIXED) {
+        fprintf(writePtr, "%-6s%-16s%-11s%10s\n", "Acct", "Last Name", "First Name", "Balance");
+    } else if (format == EXPORT_CSV) {
+        fputs("acct,last_name,first_name,balance\n", writePtr);
+    }
+
+    if (scanRecords(store, NULL, format, writePtr, &lines) != 0) {
+        status = -1;
+    }
+    bytes = ftell(writePtr);
+    if (fclose(writePtr) != 0) {
+        status = -1;
+    }
+    free(buffer);
+
+    if (status != 0) {
+        printf("Error: %s may be incomplete.\n", fileNames[format]);
+        return status;
+    }
+    printf("%s created.\n", fileNames[format]);
+    if (verbose) {
+        double seconds = elapsedSeconds(started);
 
-    fclose(writePtr);
-    puts("accounts.txt created.");
+        printf("Exported %lu accounts (%ld bytes) in %.3f s", lines, bytes, seconds);
+        if (seconds > 0) {
+            printf(" (%.1f MB/s)", bytes / seconds / 1e6);
+        }
+        putchar('\n');
+    }
+    return status;
 }
 
 // Enhanced update record with transaction history
-void updateRecord(FILE *fPtr) {
+void updateRecord(struct accountStore *store) {
     struct clientData client;
     unsigned int account;
-    double transaction;
+    double input;
+    money_t transaction;
+    money_t balance;
+    int status;
 
-    printf("Enter account to update (1 - %d): ", MAX_ACCOUNTS);
+    printf("Enter account to update (1 - %u): ", MAX_ACCOUNT_NUMBER);
     scanf("%u", &account);
     clearInputBuffer();
 
-    if (account < 1 || account > MAX_ACCOUNTS) {
+    status = accountGet(store, account, &client);
+    if (status == ACCOUNT_BAD_NUMBER) {
         puts("Invalid account number.");
         return;
     }
 
-    fseek(fPtr, (account - 1) * sizeof(struct clientData), SEEK_SET);
-    fread(&client, sizeof(struct clientData), 1, fPtr);
-
-    if (client.acctNum == 0) {
+    if (status != ACCOUNT_OK) {
         printf("Account #%u not found.\n", account);
     } else {
-        printf("Current balance: %.2f\n", client.balance);
+        printf("Current balance: %.2f\n", moneyToDouble(client.balance));
         printf("Enter transaction amount (+deposit or -withdrawal): ");
-        scanf("%lf", &transaction);
+        scanf("%lf", &input);
         clearInputBuffer();
 
-        client.balance += transaction;
-        
-        // Add transaction to history
-        const char* type = (transaction >= 0) ? "Deposit" : "Withdraw";
-        addTransaction(&client, transaction, type);
+        if (moneyFromDouble(input, &transaction) != 0 ||
+            (status = accountPost(store, account, transaction, &balance)) == ACCOUNT_OUT_OF_RANGE) {
+            puts("Error: Amount is out of range.");
+            return;
+        }
+        if (status == ACCOUNT_LEDGER_ERROR) {
+            puts("Warning: Could not write to the transaction ledger.");
+        } else if (status != ACCOUNT_OK) {
+            printf("Account #%u not found.\n", account);
+            return;
+        }
 
-        fseek(fPtr, (account - 1) * sizeof(struct clientData), SEEK_SET);
-        fwrite(&client, sizeof(struct clientData), 1, fPtr);
-        printf("New balance: %.2f\n", client.balance);
+        printf("New balance: %.2f\n", moneyToDouble(balance));
         puts("Transaction recorded in history.");
     }
 }
 
 // Add new account
-void addAccount(FILE *fPtr) {
-    struct clientData client = {0, "", "", 0.0, {}, 0};
+void addAccount(struct accountStore *store) {
+    struct clientData client = {0, "", "", 0, LEDGER_NONE, 0};
     unsigned int account;
+    double initialBalance;
+    int status;
 
-    printf("Enter new account number (1 - %d): ", MAX_ACCOUNTS);
+    printf("Enter new account number (1 - %u): ", MAX_ACCOUNT_NUMBER);
     scanf("%u", &account);
     clearInputBuffer();
 
-    if (account < 1 || account > MAX_ACCOUNTS) {
+    status = accountGet(store, account, &client);
+    if (status == ACCOUNT_BAD_NUMBER) {
         puts("Invalid account number.");
         return;
     }
 
-    fseek(fPtr, (account - 1) * sizeof(struct clientData), SEEK_SET);
-    fread(&client, sizeof(struct clientData), 1, fPtr);
-
-    if (client.acctNum != 0) {
+    if (status == ACCOUNT_OK) {
         puts("Account already exists.");
         return;
     }
+    memset(&client, 0, sizeof(client));
 
     client.acctNum = account;
 
@@ -210,78 +1103,77 @@ void addAccount(FILE *fPtr) {
     clearInputBuffer();
 
     printf("Enter initial balance: ");
-    scanf("%lf", &client.balance);
+    scanf("%lf", &initialBalance);
     clearInputBuffer();
 
-    // Add initial balance as first transaction if > 0
-    if (client.balance > 0) {
-        addTransaction(&client, client.balance, "Initial");
+    if (moneyFromDouble(initialBalance, &client.balance) != 0) {
+        puts("Error: Balance is out of range.");
+        return;
     }
 
-    fseek(fPtr, (account - 1) * sizeof(struct clientData), SEEK_SET);
-    fwrite(&client, sizeof(struct clientData), 1, fPtr);
+    status = accountCreate(store, &client);
+    if (status == ACCOUNT_NO_SPACE) {
+        puts("Error: Could not allocate space for the account.");
+        return;
+    }
+    if (status == ACCOUNT_EXISTS) {
+        puts("Account already exists.");
+        return;
+    }
+    if (status == ACCOUNT_LEDGER_ERROR) {
+        puts("Error: Could not write to the transaction ledger; the account was not created.");
+        return;
+    }
 
     puts("Account created successfully.");
 }
 
 // Delete account
-void deleteAccount(FILE *fPtr) {
-    struct clientData client;
-    struct clientData blankClient = {0, "", "", 0.0, {}, 0};
+void deleteAccount(struct accountStore *store) {
     unsigned int account;
+    int status;
 
-    printf("Enter account to delete (1 - %d): ", MAX_ACCOUNTS);
+    printf("Enter account to delete (1 - %u): ", MAX_ACCOUNT_NUMBER);
     scanf("%u", &account);
     clearInputBuffer();
 
-    if (account < 1 || account > MAX_ACCOUNTS) {
+    status = accountDelete(store, account);
+    if (status == ACCOUNT_BAD_NUMBER) {
         puts("Invalid account number.");
-        return;
-    }
-
-    fseek(fPtr, (account - 1) * sizeof(struct clientData), SEEK_SET);
-    fread(&client, sizeof(struct clientData), 1, fPtr);
-
-    if (client.acctNum == 0) {
+    } else if (status != ACCOUNT_OK) {
         puts("Account does not exist.");
     } else {
-        fseek(fPtr, (account - 1) * sizeof(struct clientData), SEEK_SET);
-        fwrite(&blankClient, sizeof(struct clientData), 1, fPtr);
         puts("Account deleted.");
     }
 }
 
 // Display specific account
-void displayAccount(FILE *fPtr) {
+void displayAccount(struct accountStore *store) {
     struct clientData client;
     unsigned int account;
+    int status;
 
-    printf("Enter account number to view (1 - %d): ", MAX_ACCOUNTS);
+    printf("Enter account number to view (1 - %u): ", MAX_ACCOUNT_NUMBER);
     scanf("%u", &account);
     clearInputBuffer();
 
-    if (account < 1 || account > MAX_ACCOUNTS) {
+    status = accountGet(store, account, &client);
+    if (status == ACCOUNT_BAD_NUMBER) {
         puts("Invalid account number.");
-        return;
-    }
-
-    fseek(fPtr, (account - 1) * sizeof(struct clientData), SEEK_SET);
-    fread(&client, sizeof(struct clientData), 1, fPtr);
-
-    if (client.acctNum == 0) {
+    } else if (status != ACCOUNT_OK) {
         puts("No record found.");
     } else {
         printf("Account #%u\nLast Name: %s\nFirst Name: %s\nBalance: %.2f\n",
-               client.acctNum, client.lastName, client.firstName, client.balance);
+               client.acctNum, client.lastName, client.firstName, moneyToDouble(client.balance));
         printf("Total Transactions: %d\n", client.transaction_count);
     }
 }
 
 // NEW FEATURE 1: Search account by name
-void searchAccountByName(FILE *fPtr) {
-    struct clientData client;
+void searchAccountByName(struct accountStore *store) {
     char searchName[20];
-    int found = 0;
+    struct clientData *matches;
+    size_t found = 0;
 
     printf("Enter name to search (first or last name): ");
     scanf("%19s", searchName);
@@ -294,199 +1186,257 @@ void searchAccountByName(FILE *fPtr) {
         }
     }
 
-    rewind(fPtr);
     printf("\n=== Search Results ===\n");
     printf("%-6s%-16s%-11s%10s\n", "Acct", "Last Name", "First Name", "Balance");
     printf("---------------------------------------------------\n");
 
-    while (fread(&client, sizeof(struct clientData), 1, fPtr) == 1) {
-        if (client.acctNum != 0) {
-            char tempLast[LAST_NAME_LEN], tempFirst[FIRST_NAME_LEN];
-            strcpy(tempLast, client.lastName);
-            strcpy(tempFirst, client.firstName);
-
-            // Convert to lowercase for comparison
-            for (int i = 0; tempLast[i]; i++) {
-                if (tempLast[i] >= 'A' && tempLast[i] <= 'Z') {
-                    tempLast[i] = tempLast[i] + 32;
-                }
-            }
-            for (int i = 0; tempFirst[i]; i++) {
-                if (tempFirst[i] >= 'A' && tempFirst[i] <= 'Z') {
-                    tempFirst[i] = tempFirst[i] + 32;
-                }
-            }
-
-            // Check if search term is found in either name
-            if (strstr(tempLast, searchName) != NULL || strstr(tempFirst, searchName) != NULL) {
-                printf("%-6u%-16s%-11s%10.2f\n",
-                       client.acctNum, client.lastName, client.firstName, client.balance);
-                found++;
-            }
-        }
+    switch (accountSearch(store, searchName, &matches, &found)) {
+        case ACCOUNT_OK:
+            break;
+        case ACCOUNT_NO_MEMORY:
+            puts("Error: Not enough memory to list every match.");
+            break;
+        default:
+            puts("Error: Some accounts could not be searched.");
+            break;
     }
+    for (size_t i = 0; i < found; i++) {
+        printf("%-6u%-16s%-11s%10.2f\n",
+               matches[i].acctNum, matches[i].lastName, matches[i].firstName, moneyToDouble(matches[i].balance));
+    }
+    free(matches);
 
     if (found == 0) {
         printf("No accounts found matching '%s'\n", searchName);
     } else {
-        printf("\nTotal accounts found: %d\n", found);
+        printf("\nTotal accounts found: %zu\n", found);
     }
 }
 
 // NEW FEATURE 2: View transaction history
-void viewTransactionHistory(FILE *fPtr) {
-    struct clientData client;
+void viewTransactionHistory(struct accountStore *store) {
+    struct clientData buffer;
+    struct clientData *client;
     unsigned int account;
+    struct ledgerEntry entry;
+    struct transaction page[HISTORY_PAGE];
+    char date[DATE_LEN];
+    long long offset;
+    char more = 'y';
 
-    printf("Enter account number to view history (1 - %d): ", MAX_ACCOUNTS);
+    printf("Enter account number to view history (1 - %u): ", MAX_ACCOUNT_NUMBER);
     scanf("%u", &account);
     clearInputBuffer();
 
-    if (account < 1 || account > MAX_ACCOUNTS) {
+    if (account < 1 || account > MAX_ACCOUNT_NUMBER) {
         puts("Invalid account number.");
         return;
     }
 
-    fseek(fPtr, (account - 1) * sizeof(struct clientData), SEEK_SET);
-    fread(&client, sizeof(struct clientData), 1, fPtr);
+    client = fetchRecord(store, account, &buffer);
 
-    if (client.acctNum == 0) {
+    if (client == NULL || client->acctNum == 0) {
         puts("Account not found.");
         return;
     }
 
-    printf("\n=== Transaction History for Account #%u ===\n", client.acctNum);
-    printf("Account Holder: %s %s\n", client.firstName, client.lastName);
-    printf("Current Balance: %.2f\n\n", client.balance);
+    printf("\n=== Transaction History for Account #%u ===\n", client->acctNum);
+    printf("Account Holder: %s %s\n", client->firstName, client->lastName);
+    printf("Current Balance: %.2f\n\n", moneyToDouble(client->balance));
 
-    if (client.transaction_count == 0) {
+    if (client->lastEntry == LEDGER_NONE) {
         puts("No transaction history available.");
         return;
     }
+    printf("Total Transactions: %d\n\n", client->transaction_count);
+
+    // Follow the ledger back-pointers one page at a time, starting with the
+    // newest page. Each page is filled back to front so it prints oldest first.
+    offset = client->lastEntry;
+    while (offset != LEDGER_NONE && (more == 'y' || more == 'Y')) {
+        int first = HISTORY_PAGE;
 
-    printf("%-20s%-10s%-12s%-12s\n", "Date", "Type", "Amount", "Balance After");
-    printf("---------------------------------------------------------------\n");
+        while (first > 0 && offset != LEDGER_NONE) {
+            if (ledgerRead(store, offset, &entry) != 0 || entry.acctNum != account) {
+                puts("Error: Transaction ledger is damaged or missing.");
+                return;
+            }
+            page[--first] = entry.txn;
+            offset = entry.prevEntry;
+        }
+
+        printf("%-20s%-10s%-12s%-12s\n", "Date", "Type", "Amount", "Balance After");
+        printf("---------------------------------------------------------------\n");
+        for (int i = first; i < HISTORY_PAGE; i++) {
+            formatTimestamp(page[i].timestamp, date, sizeof(date));
+            printf("%-20s%-10s%12.2f%12.2f\n",
+                   date,
+                   transactionTypeName(page[i].type),
+                   moneyToDouble(page[i].amount),
+                   moneyToDouble(page[i].balance_after));
+        }
 
-    for (int i = 0; i < client.transaction_count; i++) {
-        printf("%-20s%-10s%12.2f%12.2f\n",
-               client.history[i].date,
-               client.history[i].type,
-               client.history[i].amount,
-               client.history[i].balance_after);
+        if (offset != LEDGER_NONE) {
+            printf("\nShow older transactions? (y/n): ");
+            scanf("%c", &more);
+            clearInputBuffer();
+            puts("");
+        }
     }
 }
 
 // NEW FEATURE 3: Generate account summary
-void generateAccountSummary(FILE *fPtr) {
-    struct clientData client;
-    int activeAccounts = 0;
-    double totalBalance = 0.0;
-    double highestBalance = -1.0;
-    double lowestBalance = -1.0;
-    unsigned int highestAcct = 0, lowestAcct = 0;
-
-    rewind(fPtr);
+void generateAccountSummary(struct accountStore *store) {
+    struct balanceSummary summary;
 
     printf("\n=== ACCOUNT SUMMARY REPORT ===\n");
     printf("Generated on: ");
-    
+
     // Display current date
     time_t now;
     time(&now);
     printf("%s", ctime(&now));
     printf("=====================================\n");
 
-    while (fread(&client, sizeof(struct clientData), 1, fPtr) == 1) {
-        if (client.acctNum != 0) {
-            activeAccounts++;
-            totalBalance += client.balance;
+    // Computed from the balance columns; no records are read
+    accountSummary(store, &summary);
 
-            // Track highest balance
-            if (highestBalance < 0 || client.balance > highestBalance) {
-                highestBalance = client.balance;
-                highestAcct = client.acctNum;
-            }
-
-            // Track lowest balance
-            if (lowestBalance < 0 || client.balance < lowestBalance) {
-                lowestBalance = client.balance;
-                lowestAcct = client.acctNum;
-            }
-        }
+    printf("Total Active Accounts: %lu\n", summary.count);
+    if (summary.overflow) {
+        puts("Total Bank Balance: (exceeds the representable range)");
+    } else {
+        printf("Total Bank Balance: $%.2f\n", moneyToDouble(summary.total));
     }
 
-    printf("Total Active Accounts: %d\n", activeAccounts);
-    printf("Total Bank Balance: $%.2f\n", totalBalance);
-
-    if (activeAccounts > 0) {
-        printf("Average Account Balance: $%.2f\n", totalBalance / activeAccounts);
-        printf("Highest Balance: $%.2f (Account #%u)\n", highestBalance, highestAcct);
-        printf("Lowest Balance: $%.2f (Account #%u)\n", lowestBalance, lowestAcct);
+    if (summary.count > 0) {
+        if (!summary.overflow) {
+            printf("Average Account Balance: $%.2f\n", moneyToDouble(summary.total) / summary.count);
+        }
+        printf("Highest Balance: $%.2f (Account #%u)\n", moneyToDouble(summary.highest), summary.highestAcct);
+        printf("Lowest Balance: $%.2f (Account #%u)\n", moneyToDouble(summary.lowest), summary.lowestAcct);
     }
 
-    printf("Maximum Capacity: %d accounts\n", MAX_ACCOUNTS);
-    printf("Available Slots: %d\n", MAX_ACCOUNTS - activeAccounts);
+    printf("Allocated Capacity: %lu accounts (%u pages in file)\n",
+           storeCapacity(store), store->header.pageCount);
+    printf("Available Slots in Allocated Pages: %lu\n", storeCapacity(store) - summary.count);
     printf("=====================================\n");
 }
 
-// NEW FEATURE 4: Backup accounts
-void backupAccounts(FILE *fPtr) {
-    FILE *backupPtr;
-    char backupName[50];
-    char dateTime[30];
-    struct clientData client;
-    int recordsCopied = 0;
+// NEW FEATURE 4: Backup accounts. A full backup copies clients.dat and
+// the ledger on a background thread, so the menu stays usable; an
+// incremental one saves only what changed since the last backup and needs
+// that backup (and its parents) to restore.
+void backupAccounts(struct accountStore *store) {
+    char backupName[BACKUP_NAME_LEN];
+    char ledgerName[BACKUP_NAME_LEN];
+    unsigned int kind = 0;
+    unsigned int pagesWritten = 0;
+    FILE *parentPtr;
 
-    // Generate backup filename with timestamp
-    getCurrentDateTime(dateTime);
-    sprintf(backupName, "clients_backup_%s.dat", dateTime);
+    if (store->online.active) {
+        puts("A backup is still running in the background; try again when it completes.");
+        return;
+    }
 
-    // Replace spaces and colons with underscores in the filename
-    for (int i = 0; backupName[i]; i++) {
-        if (backupName[i] == ' ' || backupName[i] == ':') {
-            backupName[i] = '_';
+    printf("Backup type - 1 full, 2 incremental (changes since the last backup): ");
+    scanf("%u", &kind);
+    clearInputBuffer();
+    if (kind != 1 && kind != 2) {
+        puts("Invalid backup type.");
+        return;
+    }
+    if (kind == 2) {
+        // Only a backup this store was synced with can be built on
+        if (!store->backup.loaded || store->backup.lastBackup[0] == '\0' ||
+            (parentPtr = fopen(store->backup.lastBackup, "rb")) == NULL) {
+            puts("No previous backup to build on; making a full backup instead.");
+            kind = 1;
+        } else {
+            fclose(parentPtr);
         }
     }
 
-    if ((backupPtr = fopen(backupName, "wb")) == NULL) {
-        puts("Error: Could not create backup file.");
+    backupFileName(backupName, sizeof(backupName),
+                   kind == 1 ? "clients_backup" : "clients_increment", kind == 1 ? "dat" : "inc");
+    companionName(ledgerName, sizeof(ledgerName), backupName, LEDGER_EXTENSION);
+    if ((parentPtr = fopen(backupName, "rb")) != NULL) {
+        // Names have one-second resolution; never overwrite a backup
+        fclose(parentPtr);
+        printf("Error: %s already exists. Try again in a moment.\n", backupName);
+        return;
+    }
+
+    if (kind == 1) {
+        // Updates may go on while the pages are copied; the backup still
+        // shows the accounts exactly as they are now
+        if (onlineBackupStart(store, backupName, ledgerName) != 0) {
+            puts("Error: Could not create backup file.");
+            return;
+        }
+        if (onlineBackupFinish(store, 0) == 0) {
+            printf("Backup of %lu records (%u pages) started in the background: %s\n",
+                   storeAccountCount(store), store->online.header.pageCount, backupName);
+            puts("Its completion is reported at the menu.");
+        }
         return;
     }
 
-    rewind(fPtr);
-    
-    // Copy all records
-    while (fread(&client, sizeof(struct clientData), 1, fPtr) == 1) {
-        fwrite(&client, sizeof(struct clientData), 1, backupPtr);
-        recordsCopied++;
+    // Everything buffered must reach the files before they are read
+    storeSync(store);
+    if (writeIncrement(store, backupName, ledgerName, &pagesWritten) != 0) {
+        puts("Error: Could not create incremental backup file.");
+        return;
     }
+    backupReset(store, backupName);
 
-    fclose(backupPtr);
     printf("Backup completed successfully!\n");
-    printf("Backup file: %s\n", backupName);
-    printf("Records backed up: %d\n", recordsCopied);
-    
+    printf("Backup file: %s (ledger: %s)\n", backupName, ledgerName);
+    printf("Records backed up: %lu (%u of %u pages)\n", storeAccountCount(store),
+           pagesWritten, store->header.pageCount);
+
     time_t now;
     time(&now);
     printf("Backup created on: %s", ctime(&now));
 }
 
-// NEW FEATURE 4B: Restore from backup
-void restoreBackup(FILE **fPtr) {
+// NEW FEATURE 4B: Restore from backup. An incremental backup is restored
+// by copying the full backup it builds on and then applying each
+// increment from oldest to newest. The restored file and ledger are built
+// next to the current ones and renamed over them only once complete, so a
+// failure part way leaves the current data open and untouched.
+void restoreBackup(struct accountStore *store) {
     FILE *backupPtr;
-    char backupName[50];
-    struct clientData client;
-    int recordsRestored = 0;
+    FILE *writePtr;
+    char backupName[BACKUP_NAME_LEN];
+    char ledgerName[BACKUP_NAME_LEN];
+    static char chain[BACKUP_CHAIN_MAX][BACKUP_NAME_LEN];
+    char storeLedger[FILENAME_MAX];
+    char storeColumns[FILENAME_MAX];
+    char tempName[FILENAME_MAX + 8];
+    char tempLedger[FILENAME_MAX + 8];
+    const char *fileName = store->fileName;
+    int chainLength;
+    int useMmap = store->useMmap;
+    int noLedger;
+    int failed;
     char confirm;
 
     printf("Enter backup filename (e.g., clients_backup_2024_01_15_10_30_45.dat): ");
-    scanf("%49s", backupName);
+    scanf("%63s", backupName);
     clearInputBuffer();
 
-    if ((backupPtr = fopen(backupName, "rb")) == NULL) {
+    if ((chainLength = backupChain(backupName, chain, BACKUP_CHAIN_MAX)) < 0) {
+        puts("Error: Backup file not found, or a backup it builds on is missing.");
+        return;
+    }
+    if ((backupPtr = fopen(chain[chainLength - 1], "rb")) == NULL) {
         puts("Error: Backup file not found.");
         return;
     }
+    if (chainLength > 1) {
+        printf("Incremental backup: restores %s and %d increment(s).\n",
+               chain[chainLength - 1], chainLength - 1);
+    }
 
     printf("WARNING: This will overwrite current data. Continue? (y/n): ");
     scanf("%c", &confirm);
@@ -498,61 +1448,4281 @@ void restoreBackup(FILE **fPtr) {
         return;
     }
 
-    // Close current file and reopen for writing
-    fclose(*fPtr);
-    *fPtr = fopen("clients.dat", "wb");
+    snprintf(storeLedger, sizeof(storeLedger), "%s", store->ledgerName);
+    snprintf(storeColumns, sizeof(storeColumns), "%s", store->columnName);
+    snprintf(tempName, sizeof(tempName), "%s.tmp", fileName);
+    snprintf(tempLedger, sizeof(tempLedger), "%s.tmp", storeLedger);
 
-    if (*fPtr == NULL) {
-        puts("Error: Could not open main file for writing.");
+    // Copy the backup file as-is; legacy dense backups are converted on reopen
+    if ((writePtr = fopen(tempName, "wb")) == NULL) {
+        puts("Error: Could not create the restored file.");
         fclose(backupPtr);
         return;
     }
+    failed = copyFileBlocks(backupPtr, writePtr) != 0;
+    fclose(backupPtr);
+    failed |= fclose(writePtr) != 0;
 
-    // Copy all records from backup
-    while (fread(&client, sizeof(struct clientData), 1, backupPtr) == 1) {
-        fwrite(&client, sizeof(struct clientData), 1, *fPtr);
-        recordsRestored++;
+    // Restore the matching ledger. Older backups have none: their history
+    // is still inside the records and moves to the (empty) ledger on
+    // conversion. The current ledger never survives a restore, since the
+    // restored records' offsets do not point into it.
+    companionName(ledgerName, sizeof(ledgerName), chain[chainLength - 1], LEDGER_EXTENSION);
+    backupPtr = fopen(ledgerName, "rb");
+    noLedger = backupPtr == NULL;
+    if (!failed) {
+        if ((writePtr = fopen(tempLedger, "wb")) == NULL) {
+            failed = 1;
+        } else {
+            if (backupPtr != NULL) {
+                failed = copyFileBlocks(backupPtr, writePtr) != 0;
+            }
+            failed |= fclose(writePtr) != 0;
+        }
+    }
+    if (backupPtr != NULL) {
+        fclose(backupPtr);
     }
 
-    fclose(backupPtr);
-    fclose(*fPtr);
+    for (int i = chainLength - 2; i >= 0 && !failed; i--) {
+        if (applyIncrement(chain[i], tempName, tempLedger) != 0) {
+            printf("Error: Could not apply incremental backup %s.\n", chain[i]);
+            failed = 1;
+        }
+    }
+    if (!failed) {
+        failed = syncFileName(tempName) != 0 || syncFileName(tempLedger) != 0;
+    }
+    if (failed) {
+        puts("Error: Could not build the restored file; the current data is unchanged.");
+        remove(tempName);
+        remove(tempLedger);
+        return;
+    }
+
+    // Swap the restored files in. The ledger goes first: it is only ever
+    // read through the records.
+    storeClose(store);
+#ifdef _WIN32
+    remove(storeLedger);
+    remove(fileName);
+#endif
+    if (rename(tempLedger, storeLedger) != 0 || rename(tempName, fileName) != 0) {
+        puts("Error: Could not replace the current files with the restored ones.");
+        remove(tempName);
+        remove(tempLedger);
+        if (storeOpen(store, fileName, useMmap) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    // The balance columns describe the replaced file
+    remove(storeColumns);
 
-    // Reopen in read-write mode
-    *fPtr = fopen("clients.dat", "rb+");
+    // Reopen with the same backend. The files are already replaced, so
+    // there is nothing else to go back to.
+    if (storeOpen(store, fileName, useMmap) != 0) {
+        puts("Error: Restored file could not be opened.");
+        exit(EXIT_FAILURE);
+    }
+    if (noLedger) {
+        restoreDropHistory(store);
+    }
+    nameIndexRebuild(store);
+    // The data now equals the restored backup, so later increments build on it
+    backupReset(store, backupName);
 
     printf("Restore completed successfully!\n");
-    printf("Records restored: %d\n", recordsRestored);
+    printf("Records restored: %lu\n", storeAccountCount(store));
     puts("System ready with restored data.");
 }
 
-// Helper function: Add transaction to history
-void addTransaction(struct clientData *client, double amount, const char* type) {
-    char dateTime[DATE_LEN];
-    getCurrentDateTime(dateTime);
+// Helper function: after restoring a backup that came without a ledger,
+// forget history that points past the end of the new one, so later entries
+// are never read as some other account's history
+void restoreDropHistory(struct accountStore *store) {
+    struct clientData buffer;
+    struct clientData *client;
+    unsigned int account = 0;
+    unsigned long dropped = 0;
 
-    // Shift older transactions if we're at max capacity
-    if (client->transaction_count >= MAX_TRANSACTIONS) {
-        for (int i = 0; i < MAX_TRANSACTIONS - 1; i++) {
-            client->history[i] = client->history[i + 1];
+    while ((client = nextRecord(store, &account, &buffer)) != NULL) {
+        if (client->lastEntry != LEDGER_NONE &&
+            client->lastEntry + (long long)sizeof(struct ledgerEntry) > store->ledgerEnd) {
+            struct clientData updated = *client;
+
+            updated.lastEntry = LEDGER_NONE;
+            updated.transaction_count = 0;
+            commitRecord(store, account, &updated);
+            dropped++;
         }
-        client->transaction_count = MAX_TRANSACTIONS - 1;
     }
+    if (dropped > 0) {
+        storeSync(store);
+        printf("The backup has no transaction ledger; history cleared for %lu account(s).\n", dropped);
+    }
+}
 
-    // Add new transaction
-    strcpy(client->history[client->transaction_count].date, dateTime);
-    client->history[client->transaction_count].amount = amount;
-    strcpy(client->history[client->transaction_count].type, type);
-    client->history[client->transaction_count].balance_after = client->balance;
-    client->transaction_count++;
+// Account: copy out an account. ACCOUNT_NOT_FOUND leaves client unchanged.
+int accountGet(struct accountStore *store, unsigned int account, struct clientData *client) {
+    struct clientData buffer;
+    struct clientData *record;
+    long long started = metricsNow();
+
+    if (account < 1 || account > MAX_ACCOUNT_NUMBER) {
+        return ACCOUNT_BAD_NUMBER;
+    }
+    record = fetchRecord(store, account, &buffer);
+    if (record == NULL || record->acctNum == 0) {
+        return ACCOUNT_NOT_FOUND;
+    }
+    *client = *record;
+    metricsRecord(METRIC_LOOKUP, metricsNow() - started, sizeof(*client), 0);
+    return ACCOUNT_OK;
 }
 
-// Helper function: Get current date and time
-void getCurrentDateTime(char *dateTime) {
-    time_t now;
-    struct tm *timeinfo;
+// Account: deposit (amount > 0) or withdraw (amount < 0), record it in the
+// history and wait until it is durable. The new balance goes to *balance.
+int accountPost(struct accountStore *store, unsigned int account, money_t amount, money_t *balance) {
+    struct clientData buffer;
+    struct clientData *client;
+    int status = ACCOUNT_OK;
+    long long started = metricsNow();
 
-    time(&now);
+    if (account < 1 || account > MAX_ACCOUNT_NUMBER) {
+        return ACCOUNT_BAD_NUMBER;
+    }
+    client = fetchRecordForUpdate(store, account, &buffer);
+    if (client == NULL || client->acctNum == 0) {
+        return ACCOUNT_NOT_FOUND;
+    }
+    if (moneyAdd(&client->balance, amount) != 0) {
+        return ACCOUNT_OUT_OF_RANGE;
+    }
+
+    if (addTransaction(store, client, amount, (amount >= 0) ? TXN_DEPOSIT : TXN_WITHDRAW) != 0) {
+        status = ACCOUNT_LEDGER_ERROR;
+    }
+    commitRecord(store, account, client);
+    commitWait(store, commitEnqueue(store));
+    *balance = client->balance;
+    metricsRecord(METRIC_POST, metricsNow() - started, 0, 0);
+    return status;
+}
+
+// Account: add client (its number, names and opening balance; the history
+// fields are ignored), index its names and wait until it is durable. The
+// record goes in first, so a full store leaves nothing in the ledger, and
+// an account whose opening balance cannot be recorded is taken out again.
+int accountCreate(struct accountStore *store, const struct clientData *client) {
+    struct clientData added = *client;
+    int status;
+
+    if ((status = accountGet(store, client->acctNum, &added)) != ACCOUNT_NOT_FOUND) {
+        return status == ACCOUNT_OK ? ACCOUNT_EXISTS : status;
+    }
+    added = *client;
+    added.lastEntry = LEDGER_NONE;
+    added.transaction_count = 0;
+    if (insertRecord(store, &added) != 0) {
+        return ACCOUNT_NO_SPACE;
+    }
+
+    // The opening balance is the first transaction, if there is one
+    if (added.balance > 0) {
+        if (addTransaction(store, &added, added.balance, TXN_INITIAL) != 0) {
+            removeRecord(store, added.acctNum);
+            return ACCOUNT_LEDGER_ERROR;
+        }
+        commitRecord(store, added.acctNum, &added);
+    }
+    nameIndexRecord(store, &added, 1);
+    commitWait(store, commitEnqueue(store));
+    return ACCOUNT_OK;
+}
+
+// Account: remove an account and wait until that is durable
+int accountDelete(struct accountStore *store, unsigned int account) {
+    struct clientData client;
+    int status;
+
+    if ((status = accountGet(store, account, &client)) != ACCOUNT_OK) {
+        return status;
+    }
+    nameIndexRecord(store, &client, 0);
+    removeRecord(store, account);
+    commitWait(store, commitEnqueue(store));
+    return ACCOUNT_OK;
+}
+
+// Account: every account whose first or last name contains term (which
+// must be lowercase), in account order, as a malloc'd array the caller
+// frees. Terms of three or more characters use the name index; shorter
+// ones scan every page in parallel.
+int accountSearch(struct accountStore *store, const char *term, struct clientData **matches, size_t *count) {
+    struct recordArray found = {NULL, 0, 0, ACCOUNT_OK};
+    int indexed = store->names.loaded && strlen(term) >= 3;
+    long long started = metricsNow();
+
+    if (indexed) {
+        // Only accounts holding every trigram of the term can match
+        struct clientData buffer;
+        struct clientData *client;
+        size_t candidateCount;
+        unsigned int *candidates = nameIndexCandidates(&store->names, term, &candidateCount);
+
+        for (size_t i = 0; i < candidateCount && found.status == ACCOUNT_OK; i++) {
+            client = fetchRecord(store, candidates[i], &buffer);
+            if (client != NULL && client->acctNum != 0 && nameMatches(client, term)) {
+                recordAppend(&found, client);
+            }
+        }
+        free(candidates);
+    } else {
+        struct recordScan scan = {store, term, 0, NULL, &found, 0, 0};
+
+        if (runSearchScan(&scan) != 0 && found.status == ACCOUNT_OK) {
+            found.status = ACCOUNT_NO_MEMORY;
+        }
+    }
+
+    *matches = found.records;
+    *count = found.count;
+    metricsRecord(METRIC_SEARCH, metricsNow() - started, found.count * sizeof(struct clientData), indexed);
+    return found.status;
+}
+
+// Account: count, exact total, highest and lowest balance of all accounts,
+// from the balance columns (no records are read)
+int accountSummary(struct accountStore *store, struct balanceSummary *summary) {
+    summarizeBalances(&store->columns, store->pages, summary);
+    return ACCOUNT_OK;
+}
+
+// Helper function: Add transaction to history. Returns -1 if the ledger
+// could not be written; the change itself still stands.
+int addTransaction(struct accountStore *store, struct clientData *client, money_t amount, unsigned char type) {
+    struct transaction txn;
+
+    memset(&txn, 0, sizeof(txn));
+    txn.timestamp = currentTimestamp();
+    txn.amount = amount;
+    txn.type = type;
+    txn.balance_after = client->balance;
+
+    // Append to the ledger; the record keeps only the new back-pointer
+    return ledgerAppend(store, client, &txn) != 0 ? -1 : 0;
+}
+
+// Helper function: convert an entered amount to cents, rounding to the
+// nearest cent. Returns -1 if it is not a number or out of range.
+int moneyFromDouble(double value, money_t *money) {
+    double cents = value * MONEY_SCALE;
+
+    if (!(cents > -(double)MONEY_LIMIT && cents < (double)MONEY_LIMIT)) {
+        return -1;
+    }
+    *money = (money_t)(cents + (cents >= 0 ? 0.5 : -0.5));
+    return 0;
+}
+
+// Helper function: amount in currency units, for display only
+double moneyToDouble(money_t money) {
+    return (double)money / MONEY_SCALE;
+}
+
+// Helper function: read a balance written by a version that stored doubles
+// (same size and position, so the bits are reinterpreted)
+money_t moneyFromStoredDouble(money_t bits) {
+    double value;
+    money_t money = 0;
+
+    memcpy(&value, &bits, sizeof(value));
+    moneyFromDouble(value, &money);
+    return money;
+}
+
+// Helper function: checked *value += delta. Leaves *value unchanged and
+// returns -1 if the result would leave the accepted range.
+int moneyAdd(money_t *value, money_t delta) {
+    if (delta > MONEY_LIMIT || delta < -MONEY_LIMIT ||
+        (delta > 0 && *value > MONEY_LIMIT - delta) ||
+        (delta < 0 && *value < -MONEY_LIMIT - delta)) {
+        return -1;
+    }
+    *value += delta;
+    return 0;
+}
+
+// Helper function: current time in microseconds since the epoch (no
+// calendar conversion, so it is cheap enough for every transaction)
+long long currentTimestamp(void) {
+    struct timespec now;
+
+    if (timespec_get(&now, TIME_UTC) == 0) {
+        return (long long)time(NULL) * 1000000LL;
+    }
+    return (long long)now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+// Helper function: format a transaction timestamp as local date and time
+void formatTimestamp(long long timestamp, char *text, size_t size) {
+    time_t seconds = (time_t)(timestamp / 1000000LL);
+    struct tm *timeinfo = localtime(&seconds);
+
+    if (timeinfo == NULL || strftime(text, size, "%Y-%m-%d %H:%M:%S", timeinfo) == 0) {
+        snprintf(text, size, "?");
+    }
+}
+
+// Helper function: display name of a transaction type
+const char *transactionTypeName(unsigned char type) {
+    switch (type) {
+        case TXN_INITIAL: return "Initial";
+        case TXN_DEPOSIT: return "Deposit";
+        case TXN_WITHDRAW: return "Withdraw";
+        default: return "Unknown";
+    }
+}
+
+// Helper function: Get current date and time
+void getCurrentDateTime(char *dateTime) {
+    time_t now;
+    struct tm *timeinfo;
+
+    time(&now);
     timeinfo = localtime(&now);
-    
+
     strftime(dateTime, 20, "%Y_%m_%d_%H_%M_%S", timeinfo);
-}
\ No newline at end of file
+}
+
+// Storage: open clients.dat (creating an empty paged file if missing,
+// converting a legacy dense file in place) and, when requested, map it
+int storeOpen(struct accountStore *store, const char *fileName, int useMmap) {
+    return storeOpenMode(store, fileName, fileName, useMmap, 0);
+}
+
+// Storage: storeOpen with STORE_* flags. The ledger and the other sidecar
+// files are named after sidecarName, which is fileName except for the
+// temporary store a conversion writes: that one shares the real ledger.
+int storeOpenMode(struct accountStore *store, const char *fileName, const char *sidecarName,
+                  int useMmap, int mode) {
+    FILE *cfPtr;
+    unsigned int magic = 0;
+    long fileSize;
+
+    memset(store, 0, sizeof(*store));
+    store->fileName = fileName;
+    store->filePos = -1;
+    store->openMode = mode;
+    companionName(store->ledgerName, sizeof(store->ledgerName), sidecarName, LEDGER_EXTENSION);
+    companionName(store->indexName, sizeof(store->indexName), sidecarName, NAME_INDEX_EXTENSION);
+    companionName(store->columnName, sizeof(store->columnName), sidecarName, COLUMN_EXTENSION);
+    companionName(store->backupStateName, sizeof(store->backupStateName), sidecarName,
+                  BACKUP_STATE_EXTENSION);
+
+    if ((cfPtr = fopen(fileName, "rb+")) == NULL) {
+        puts("File could not be opened. Creating a new file...");
+        cfPtr = fopen(fileName, "wb+");
+
+        if (cfPtr == NULL) {
+            printf("Error: Could not create %s\n", fileName);
+            return -1;
+        }
+    }
+#ifdef HAVE_FLOCK
+    // Only one process may own the file; two writers would overwrite each
+    // other's records (the interactive menu, --apply and --serve all check)
+    if (flock(fileno(cfPtr), LOCK_EX | LOCK_NB) != 0) {
+        printf("Error: %s is in use by another process.\n", fileName);
+        fclose(cfPtr);
+        return -1;
+    }
+#endif
+    fseek(cfPtr, 0, SEEK_END);
+    fileSize = ftell(cfPtr);
+    rewind(cfPtr);
+
+    if (fileSize == 0) {
+        // A new file holds only the header; pages are added on demand
+        store->fp = cfPtr;
+        store->header.magic = STORE_MAGIC;
+        store->header.version = STORE_VERSION;
+        store->header.recordSize = sizeof(struct clientData);
+        store->header.recordsPerPage = RECORDS_PER_PAGE;
+        store->header.freePageHead = NO_PAGE;
+        writeStoreHeader(store);
+        fflush(cfPtr);
+    } else if (fread(&magic, sizeof(magic), 1, cfPtr) == 1 && magic != STORE_MAGIC) {
+        fclose(cfPtr);
+        if (convertLegacyFile(fileName) != 0) {
+            return -1;
+        }
+        return storeOpenMode(store, fileName, sidecarName, useMmap, mode);
+    } else {
+        store->fp = cfPtr;
+        rewind(cfPtr);
+        if (fread(&store->header, sizeof(struct storeHeader), 1, cfPtr) != 1) {
+            printf("Error: %s is truncated.\n", fileName);
+            fclose(cfPtr);
+            store->fp = NULL;
+            return -1;
+        }
+        if ((store->header.version == 1 &&
+             store->header.recordSize == sizeof(struct legacyClientData)) ||
+            (store->header.version == 2 &&
+             store->header.recordSize == sizeof(struct clientData))) {
+            // Older record layout: rewrite in the current format
+            fclose(cfPtr);
+            store->fp = NULL;
+            if (convertLegacyFile(fileName) != 0) {
+                return -1;
+            }
+            return storeOpenMode(store, fileName, sidecarName, useMmap, mode);
+        }
+        if (store->header.version != STORE_VERSION ||
+            store->header.recordSize != sizeof(struct clientData) ||
+            store->header.recordsPerPage != RECORDS_PER_PAGE) {
+            printf("Error: %s has an unsupported format.\n", fileName);
+            fclose(cfPtr);
+            store->fp = NULL;
+            return -1;
+        }
+    }
+
+    // Every open is a new generation, whichever sidecars load below: one
+    // written in an earlier session matches only openGeneration
+    store->openGeneration = store->header.generation;
+    store->header.generation++;
+    writeStoreHeader(store);
+
+    // Rebuild the page directory from the page headers
+    if (store->header.pageCount > 0) {
+        store->pages = malloc(store->header.pageCount * sizeof(struct pageHeader));
+        if (store->pages == NULL) {
+            puts("Error: Out of memory while loading page directory.");
+            storeClose(store);
+            return -1;
+        }
+    }
+    for (unsigned int page = 0; page < store->header.pageCount; page++) {
+        fseek(cfPtr, pageOffset(page), SEEK_SET);
+        if (fread(&store->pages[page], sizeof(struct pageHeader), 1, cfPtr) != 1) {
+            printf("Error: %s is truncated.\n", fileName);
+            storeClose(store);
+            return -1;
+        }
+        if (store->pages[page].logicalPage != NO_PAGE &&
+            setDirectoryEntry(store, store->pages[page].logicalPage, page) != 0) {
+            puts("Error: Out of memory while loading page directory.");
+            storeClose(store);
+            return -1;
+        }
+    }
+
+    if (ledgerOpen(store) != 0) {
+        printf("Error: Could not open %s\n", store->ledgerName);
+        storeClose(store);
+        return -1;
+    }
+    if (!(mode & STORE_CONVERTING)) {
+        backupStateOpen(store);
+        columnsOpen(store);
+        if (ledgerRecover(store) != 0) {
+            printf("Warning: Could not check %s for interrupted transfers.\n", store->ledgerName);
+        }
+    }
+
+    if (useMmap) {
+#ifdef HAVE_MMAP
+        store->useMmap = 1;
+        if (storeMap(store) != 0) {
+            puts("Warning: mmap failed, using buffered file access.");
+            store->useMmap = 0;
+        }
+#else
+        puts("Warning: mmap is not available on this platform, using buffered file access.");
+#endif
+    }
+
+    commitStart(store);
+    return 0;
+}
+
+// Storage: flush pending changes and release the file and mapping
+void storeClose(struct accountStore *store) {
+    onlineBackupFinish(store, 1);
+    commitStop(store);
+    nameIndexClose(&store->names);
+    if (store->columns.loaded) {
+        columnsSave(store, 1);
+    }
+    free(store->columns.balances);
+    free(store->columns.active);
+    if (store->backup.loaded) {
+        backupStateSave(store, 1);
+    }
+    free(store->backup.dirty);
+    storeSync(store);
+    if (!(store->openMode & STORE_CONVERTING)) {
+        ledgerMarkChecked(store);
+    }
+    storeUnmap(store);
+    if (store->fp != NULL) {
+        fclose(store->fp);
+    }
+    if (store->ledgerPtr != NULL) {
+        fclose(store->ledgerPtr);
+    }
+    free(store->pages);
+    free(store->directory);
+    memset(store, 0, sizeof(*store));
+}
+
+// Storage: look up a record. The mmap backend returns a pointer into the
+// mapping (changes through it are live); the stdio backend reads the
+// record into buffer. Returns NULL if the account's page is not allocated.
+struct clientData *fetchRecord(struct accountStore *store, unsigned int account, struct clientData *buffer) {
+    long offset = recordOffset(store, account);
+    long long started;
+    int sequential;
+
+    if (offset < 0) {
+        return NULL;
+    }
+
+    if (store->map != NULL) {
+        metricsRecord(METRIC_READ, METRIC_UNTIMED, sizeof(struct clientData), 1);
+        return (struct clientData *)(store->map + offset);
+    }
+
+    // Sequential scans read straight through without repositioning
+    started = metricsNow();
+    if (!(sequential = store->filePos == offset)) {
+        fseek(store->fp, offset, SEEK_SET);
+        metricsRecord(METRIC_SEEK, METRIC_UNTIMED, 0, 0);
+    }
+    if (fread(buffer, sizeof(struct clientData), 1, store->fp) != 1) {
+        store->filePos = -1;
+        return NULL;
+    }
+    store->filePos = offset + (long)sizeof(struct clientData);
+    metricsRecord(METRIC_READ, metricsNow() - started, sizeof(struct clientData), sequential);
+    return buffer;
+}
+
+// Storage: look up a record that the caller will change. With the mmap
+// backend the change happens in place before commitRecord, so a running
+// online backup must get the page's old image now.
+struct clientData *fetchRecordForUpdate(struct accountStore *store, unsigned int account, struct clientData *buffer) {
+    long offset = recordOffset(store, account);
+
+    if (offset >= 0) {
+        onlineBackupPreserve(store, offset, sizeof(struct clientData));
+    }
+    return fetchRecord(store, account, buffer);
+}
+
+// Storage: write an existing record back. For the mmap backend a pointer
+// obtained from fetchRecord is already in place and only the dirty range
+// is scheduled for writeback.
+int commitRecord(struct accountStore *store, unsigned int account, struct clientData *client) {
+    long offset = recordOffset(store, account);
+
+    if (offset < 0) {
+        return -1;
+    }
+    writeStoreBytes(store, offset, client, sizeof(struct clientData));
+    columnsUpdate(store, account, client);
+    return 0;
+}
+
+// Storage: place a new account, allocating its page if needed (O(1))
+int insertRecord(struct accountStore *store, struct clientData *client) {
+    unsigned int logicalPage = (client->acctNum - 1) / RECORDS_PER_PAGE;
+    unsigned int page;
+
+    if (client->acctNum < 1 || client->acctNum > MAX_ACCOUNT_NUMBER) {
+        return -1;
+    }
+
+    if (logicalPage < store->directorySize && store->directory[logicalPage] != NO_PAGE) {
+        page = store->directory[logicalPage];
+    } else if ((page = allocatePage(store, logicalPage)) == NO_PAGE) {
+        return -1;
+    }
+
+    store->pages[page].liveCount++;
+    writePageHeader(store, page);
+    return commitRecord(store, client->acctNum, client);
+}
+
+// Storage: blank an account's slot; a page whose last account goes away
+// is pushed onto the free page list for reuse
+int removeRecord(struct accountStore *store, unsigned int account) {
+    struct clientData blankClient = {0, "", "", 0, LEDGER_NONE, 0};
+    unsigned int logicalPage = (account - 1) / RECORDS_PER_PAGE;
+    unsigned int page;
+
+    if (commitRecord(store, account, &blankClient) != 0) {
+        return -1;
+    }
+
+    page = store->directory[logicalPage];
+    if (store->pages[page].liveCount > 0) {
+        store->pages[page].liveCount--;
+    }
+    if (store->pages[page].liveCount == 0) {
+        store->directory[logicalPage] = NO_PAGE;
+        store->pages[page].logicalPage = NO_PAGE;
+        store->pages[page].nextFree = store->header.freePageHead;
+        store->header.freePageHead = page;
+        writeStoreHeader(store);
+    }
+    writePageHeader(store, page);
+    return 0;
+}
+
+// Storage: iterate accounts in account-number order. Returns the first
+// record after *account and updates *account, or NULL at the end.
+struct clientData *nextRecord(struct accountStore *store, unsigned int *account, struct clientData *buffer) {
+    unsigned int logicalPage = *account / RECORDS_PER_PAGE;
+    unsigned int slot = *account % RECORDS_PER_PAGE;
+
+    for (; logicalPage < store->directorySize; logicalPage++, slot = 0) {
+        if (store->directory[logicalPage] == NO_PAGE) continue;
+
+        for (; slot < RECORDS_PER_PAGE; slot++) {
+            unsigned int candidate = logicalPage * RECORDS_PER_PAGE + slot + 1;
+            struct clientData *client = fetchRecord(store, candidate, buffer);
+            if (client != NULL && client->acctNum != 0) {
+                *account = candidate;
+                return client;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Storage: commit point, make all changes durable in clients.dat
+void storeSync(struct accountStore *store) {
+    // Ledger entries go out before the records that point at them
+    if (store->ledgerPtr != NULL) {
+        fflush(store->ledgerPtr);
+    }
+#ifdef HAVE_MMAP
+    if (store->map != NULL) {
+        msync(store->map, (size_t)pageOffset(store->header.pageCount), MS_SYNC);
+        return;
+    }
+#endif
+    if (store->fp != NULL) {
+        fflush(store->fp);
+    }
+}
+
+// Storage: accounts that fit in the currently allocated pages
+unsigned long storeCapacity(const struct accountStore *store) {
+    unsigned long inUse = 0;
+
+    for (size_t i = 0; i < store->directorySize; i++) {
+        if (store->directory[i] != NO_PAGE) inUse++;
+    }
+    return inUse * RECORDS_PER_PAGE;
+}
+
+// Storage: accounts currently in use
+unsigned long storeAccountCount(const struct accountStore *store) {
+    unsigned long count = 0;
+
+    for (size_t i = 0; i < store->directorySize; i++) {
+        if (store->directory[i] != NO_PAGE) count += store->pages[store->directory[i]].liveCount;
+    }
+    return count;
+}
+
+// Helper function: file offset of a page
+long pageOffset(unsigned int page) {
+    return (long)sizeof(struct storeHeader) + (long)page * (long)PAGE_BYTES;
+}
+
+// Helper function: file offset of an account's record, -1 if unallocated
+long recordOffset(const struct accountStore *store, unsigned int account) {
+    unsigned int logicalPage;
+
+    if (account < 1) {
+        return -1;
+    }
+    logicalPage = (account - 1) / RECORDS_PER_PAGE;
+    if (logicalPage >= store->directorySize || store->directory[logicalPage] == NO_PAGE) {
+        return -1;
+    }
+    return pageOffset(store->directory[logicalPage]) + (long)sizeof(struct pageHeader) +
+           (long)((account - 1) % RECORDS_PER_PAGE) * (long)sizeof(struct clientData);
+}
+
+// Helper function: point a logical page at a physical page, growing the
+// in-memory directory as needed
+int setDirectoryEntry(struct accountStore *store, unsigned int logicalPage, unsigned int page) {
+    if (logicalPage >= store->directorySize) {
+        size_t newSize = store->directorySize ? store->directorySize : 64;
+        unsigned int *grown;
+
+        while (newSize <= logicalPage) newSize *= 2;
+        grown = realloc(store->directory, newSize * sizeof(unsigned int));
+        if (grown == NULL) {
+            return -1;
+        }
+        for (size_t i = store->directorySize; i < newSize; i++) grown[i] = NO_PAGE;
+        store->directory = grown;
+        store->directorySize = newSize;
+    }
+    store->directory[logicalPage] = page;
+    return 0;
+}
+
+// Helper function: give a logical page a physical page, reusing a freed
+// page when one is available and otherwise growing the file by one page.
+// With --mmap the file is extended under the existing mapping, which is
+// only replaced once its spare pages run out.
+unsigned int allocatePage(struct accountStore *store, unsigned int logicalPage) {
+    unsigned int page = store->header.freePageHead;
+
+    if (page != NO_PAGE) {
+        store->header.freePageHead = store->pages[page].nextFree;
+    } else {
+        struct pageHeader *grown;
+
+        grown = realloc(store->pages, (store->header.pageCount + 1) * sizeof(struct pageHeader));
+        if (grown == NULL) {
+            return NO_PAGE;
+        }
+        store->pages = grown;
+        page = store->header.pageCount;
+
+#ifdef HAVE_MMAP
+        if (store->map != NULL) {
+            // The new page reads as zeros, like the blank page written below
+            fflush(store->fp);
+            if (ftruncate(fileno(store->fp), pageOffset(page + 1)) != 0) {
+                return NO_PAGE;
+            }
+        } else
+#endif
+        {
+            unsigned char *blankPage = calloc(1, PAGE_BYTES);
+
+            if (blankPage == NULL) {
+                return NO_PAGE;
+            }
+            fseek(store->fp, pageOffset(page), SEEK_SET);
+            fwrite(blankPage, PAGE_BYTES, 1, store->fp);
+            fflush(store->fp);
+            store->filePos = -1;
+            free(blankPage);
+        }
+
+        store->header.pageCount++;
+        if (store->columns.loaded && columnsReserve(&store->columns, store->header.pageCount) != 0) {
+            // Out of memory: drop the columns and rebuild them on next open
+            free(store->columns.balances);
+            free(store->columns.active);
+            memset(&store->columns, 0, sizeof(store->columns));
+        }
+        if (store->backup.loaded && backupReserve(&store->backup, store->header.pageCount) != 0) {
+            // Out of memory: stop tracking; the next backup is a full one
+            free(store->backup.dirty);
+            memset(&store->backup, 0, sizeof(store->backup));
+        }
+        if (store->map != NULL && (size_t)pageOffset(store->header.pageCount) > store->mapLength &&
+            storeRemap(store) != 0) {
+            puts("Warning: mmap failed, using buffered file access.");
+            store->useMmap = 0;
+        }
+    }
+
+    if (setDirectoryEntry(store, logicalPage, page) != 0) {
+        return NO_PAGE;
+    }
+    store->pages[page].logicalPage = logicalPage;
+    store->pages[page].liveCount = 0;
+    store->pages[page].nextFree = NO_PAGE;
+    writePageHeader(store, page);
+    writeStoreHeader(store);
+    return page;
+}
+
+// Helper function: write bytes at a file offset through the active backend
+void writeStoreBytes(struct accountStore *store, long offset, const void *data, size_t size) {
+    long long started = metricsNow();
+
+    onlineBackupPreserve(store, offset, size);
+    backupMarkDirty(store, offset, size);
+#ifdef HAVE_MMAP
+    if (store->map != NULL) {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        size_t start = (size_t)offset - (size_t)offset % (size_t)pageSize;
+
+        if (store->map + offset != data) {
+            memmove(store->map + offset, data, size);
+        }
+        msync(store->map + start, (size_t)offset + size - start, MS_ASYNC);
+        metricsRecord(METRIC_WRITE, metricsNow() - started, size, 0);
+        return;
+    }
+#endif
+    fseek(store->fp, offset, SEEK_SET);
+    fwrite(data, size, 1, store->fp);
+    store->filePos = -1;
+    metricsRecord(METRIC_SEEK, METRIC_UNTIMED, 0, 0);
+    metricsRecord(METRIC_WRITE, metricsNow() - started, size, 0);
+}
+
+void writeStoreHeader(struct accountStore *store) {
+    writeStoreBytes(store, 0, &store->header, sizeof(struct storeHeader));
+}
+
+void writePageHeader(struct accountStore *store, unsigned int page) {
+    writeStoreBytes(store, pageOffset(page), &store->pages[page], sizeof(struct pageHeader));
+}
+
+// Helper function: map the whole file and MAP_SPARE_PAGES beyond its end
+// (mmap backend only); pages past the end become usable as the file grows
+int storeMap(struct accountStore *store) {
+#ifdef HAVE_MMAP
+    void *map;
+
+    fflush(store->fp);
+    store->mapLength = (size_t)pageOffset(store->header.pageCount + MAP_SPARE_PAGES);
+    map = mmap(NULL, store->mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(store->fp), 0);
+    if (map == MAP_FAILED) {
+        store->mapLength = 0;
+        return -1;
+    }
+    store->map = map;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void storeUnmap(struct accountStore *store) {
+#ifdef HAVE_MMAP
+    if (store->map != NULL) {
+        msync(store->map, (size_t)pageOffset(store->header.pageCount), MS_SYNC);
+        munmap(store->map, store->mapLength);
+        store->map = NULL;
+        store->mapLength = 0;
+    }
+#endif
+}
+
+// Helper function: map a grown file again. Nothing is synced: the old
+// mapping's changes are already in the shared page cache.
+int storeRemap(struct accountStore *store) {
+#ifdef HAVE_MMAP
+    munmap(store->map, store->mapLength);
+    store->map = NULL;
+    store->mapLength = 0;
+    return storeMap(store);
+#else
+    return -1;
+#endif
+}
+
+// Helper function: rewrite an older clients.dat into the current format.
+// Handles dense files (record n at offset (n-1) * record size, no header)
+// and version 1 paged files; embedded history is appended to the ledger.
+int convertLegacyFile(const char *fileName) {
+    FILE *legacyPtr;
+    FILE *tempPtr;
+    struct accountStore converted;
+    struct legacyClientData legacy;
+    struct storeHeader header;
+    char tempName[FILENAME_MAX];
+    unsigned long accounts = 0;
+    int currentRecords;
+
+    if ((legacyPtr = fopen(fileName, "rb")) == NULL) {
+        return -1;
+    }
+    currentRecords = fread(&header, sizeof(header), 1, legacyPtr) == 1 &&
+                     header.magic == STORE_MAGIC && header.version == 2;
+    snprintf(tempName, sizeof(tempName), "%s.tmp", fileName);
+    if ((tempPtr = fopen(tempName, "wb")) == NULL) {
+        fclose(legacyPtr);
+        return -1;
+    }
+    fclose(tempPtr);
+    // Version 2 records keep their ledger offsets, so an older ledger is
+    // converted (and the offsets remapped) by the real store afterwards
+    if (storeOpenMode(&converted, tempName, fileName, 0,
+                      STORE_CONVERTING | (currentRecords ? STORE_DEFER_LEDGER : 0)) != 0) {
+        fclose(legacyPtr);
+        return -1;
+    }
+
+    if (currentRecords) {
+        // Version 2 paged file: current records with double balances
+        struct pageHeader pageHeader;
+        struct clientData client;
+
+        for (unsigned int page = 0; page < header.pageCount; page++) {
+            fseek(legacyPtr, pageOffset(page), SEEK_SET);
+            if (fread(&pageHeader, sizeof(pageHeader), 1, legacyPtr) != 1) {
+                break;
+            }
+            if (pageHeader.logicalPage == NO_PAGE) {
+                continue;
+            }
+            for (int i = 0; i < RECORDS_PER_PAGE; i++) {
+                if (fread(&client, sizeof(client), 1, legacyPtr) != 1) {
+                    break;
+                }
+                client.balance = moneyFromStoredDouble(client.balance);
+                if (client.acctNum != 0 && insertRecord(&converted, &client) == 0) {
+                    accounts++;
+                }
+            }
+        }
+    } else if (header.magic == STORE_MAGIC) {
+        // Version 1 paged file: same page structure, larger records
+        long legacyPageBytes = (long)(sizeof(struct pageHeader) +
+                                      RECORDS_PER_PAGE * sizeof(struct legacyClientData));
+        struct pageHeader pageHeader;
+
+        for (unsigned int page = 0; page < header.pageCount; page++) {
+            fseek(legacyPtr, (long)sizeof(struct storeHeader) + (long)page * legacyPageBytes, SEEK_SET);
+            if (fread(&pageHeader, sizeof(pageHeader), 1, legacyPtr) != 1) {
+                break;
+            }
+            if (pageHeader.logicalPage == NO_PAGE) {
+                continue;
+            }
+            for (int i = 0; i < RECORDS_PER_PAGE; i++) {
+                if (fread(&legacy, sizeof(legacy), 1, legacyPtr) != 1) {
+                    break;
+                }
+                if (legacy.acctNum != 0 && convertLegacyRecord(&converted, &legacy) == 0) {
+                    accounts++;
+                }
+            }
+        }
+    } else {
+        rewind(legacyPtr);
+        while (fread(&legacy, sizeof(legacy), 1, legacyPtr) == 1) {
+            if (legacy.acctNum != 0 && convertLegacyRecord(&converted, &legacy) == 0) {
+                accounts++;
+            }
+        }
+    }
+
+    fclose(legacyPtr);
+    storeClose(&converted);
+    if (rename(tempName, fileName) != 0) {
+        remove(fileName);
+        if (rename(tempName, fileName) != 0) {
+            printf("Error: Could not replace %s with converted file.\n", fileName);
+            return -1;
+        }
+    }
+    printf("Converted %s to the current format (%lu accounts).\n", fileName, accounts);
+    return 0;
+}
+
+// Helper function: insert one old-style record, moving its history
+// (oldest first) into the ledger
+int convertLegacyRecord(struct accountStore *store, const struct legacyClientData *legacy) {
+    struct clientData client = {0, "", "", 0, LEDGER_NONE, 0};
+    int count = legacy->transaction_count;
+
+    client.acctNum = legacy->acctNum;
+    memcpy(client.lastName, legacy->lastName, LAST_NAME_LEN);
+    memcpy(client.firstName, legacy->firstName, FIRST_NAME_LEN);
+    moneyFromDouble(legacy->balance, &client.balance);
+
+    if (count > LEGACY_TRANSACTIONS) count = LEGACY_TRANSACTIONS;
+    for (int i = 0; i < count; i++) {
+        struct transaction txn;
+
+        convertLegacyTransaction(&legacy->history[i], &txn);
+        if (ledgerAppend(store, &client, &txn) != 0) {
+            return -1;
+        }
+    }
+    return insertRecord(store, &client);
+}
+
+// Ledger: open (or create) the transaction ledger next to clients.dat
+int ledgerOpen(struct accountStore *store) {
+    struct ledgerHeader header;
+    char remapName[FILENAME_MAX + 8];
+    FILE *ledgerPtr;
+
+    // Finish a conversion that was interrupted after it started on the records
+    snprintf(remapName, sizeof(remapName), "%s" LEDGER_REMAP_SUFFIX, store->ledgerName);
+    if ((ledgerPtr = fopen(remapName, "rb")) != NULL) {
+        fclose(ledgerPtr);
+        if (ledgerRemapRecords(store) != 0) {
+            return -1;
+        }
+    }
+
+    if ((ledgerPtr = fopen(store->ledgerName, "rb+")) == NULL) {
+        if ((ledgerPtr = fopen(store->ledgerName, "wb+")) == NULL) {
+            return -1;
+        }
+    }
+
+    if (fread(&header, sizeof(header), 1, ledgerPtr) != 1) {
+        // New (or empty) ledger: write the header so no entry sits at offset 0
+        memset(&header, 0, sizeof(header));
+        header.magic = LEDGER_MAGIC;
+        header.version = LEDGER_VERSION;
+        rewind(ledgerPtr);
+        if (fwrite(&header, sizeof(header), 1, ledgerPtr) != 1) {
+            fclose(ledgerPtr);
+            return -1;
+        }
+    } else if (header.magic == LEDGER_MAGIC && (header.version == 1 || header.version == 2)) {
+        fclose(ledgerPtr);
+        if (store->openMode & STORE_DEFER_LEDGER) {
+            return 0;   // no ledger until the real store converts it
+        }
+        if (convertLegacyLedger(store, header.version) != 0) {
+            return -1;
+        }
+        return ledgerOpen(store);
+    } else if (header.magic != LEDGER_MAGIC || header.version != LEDGER_VERSION) {
+        fclose(ledgerPtr);
+        return -1;
+    }
+
+    fseek(ledgerPtr, 0, SEEK_END);
+    store->ledgerPtr = ledgerPtr;
+    store->ledgerEnd = ftell(ledgerPtr);
+    store->ledgerChecked = header.checkedEnd;
+    return 0;
+}
+
+// Ledger: rewrite an older ledger in the current format. Version 2 only
+// needs its double amounts turned into cents. Version 1 entries also had
+// text dates and were larger; they keep their order, so every offset maps
+// to a new one by position and back-pointers in the ledger and in the
+// store's records are rewritten. The new ledger and the records' new
+// offsets are both on disk before either replaces the old state, so a
+// crash at any point is finished by the next ledgerOpen.
+int convertLegacyLedger(struct accountStore *store, unsigned int version) {
+    struct ledgerHeader header = {LEDGER_MAGIC, LEDGER_VERSION, 0, {0}};
+    struct legacyLedgerEntry legacy;
+    struct ledgerEntry entry;
+    struct ledgerRemap remap = {0, 0, LEDGER_NONE};
+    struct clientData buffer;
+    struct clientData *client;
+    unsigned int account = 0;
+    unsigned long entries = 0;
+    char tempName[FILENAME_MAX + 8];
+    char remapName[FILENAME_MAX + 8];
+    char remapTempName[FILENAME_MAX + 16];
+    FILE *legacyPtr;
+    FILE *tempPtr;
+    int failed;
+
+    snprintf(tempName, sizeof(tempName), "%s.tmp", store->ledgerName);
+    snprintf(remapName, sizeof(remapName), "%s" LEDGER_REMAP_SUFFIX, store->ledgerName);
+    snprintf(remapTempName, sizeof(remapTempName), "%s.tmp", remapName);
+    if ((legacyPtr = fopen(store->ledgerName, "rb")) == NULL) {
+        return -1;
+    }
+    if ((tempPtr = fopen(tempName, "wb")) == NULL) {
+        fclose(legacyPtr);
+        return -1;
+    }
+
+    fseek(legacyPtr, (long)sizeof(struct ledgerHeader), SEEK_SET);
+    fwrite(&header, sizeof(header), 1, tempPtr);
+    while (version == 2 && fread(&entry, sizeof(entry), 1, legacyPtr) == 1) {
+        entry.txn.amount = moneyFromStoredDouble(entry.txn.amount);
+        entry.txn.balance_after = moneyFromStoredDouble(entry.txn.balance_after);
+        fwrite(&entry, sizeof(entry), 1, tempPtr);
+        entries++;
+    }
+    while (version == 1 && fread(&legacy, sizeof(legacy), 1, legacyPtr) == 1) {
+        memset(&entry, 0, sizeof(entry));
+        entry.acctNum = legacy.acctNum;
+        if (legacy.prevEntry != LEDGER_NONE) {
+            entry.prevEntry = (long long)sizeof(struct ledgerHeader) +
+                (legacy.prevEntry - (long long)sizeof(struct ledgerHeader)) /
+                (long long)sizeof(struct legacyLedgerEntry) * (long long)sizeof(struct ledgerEntry);
+        }
+        convertLegacyTransaction(&legacy.txn, &entry.txn);
+        fwrite(&entry, sizeof(entry), 1, tempPtr);
+        entries++;
+    }
+    fclose(legacyPtr);
+    failed = fflush(tempPtr) != 0 || fsync(fileno(tempPtr)) != 0;
+    if (fclose(tempPtr) != 0 || failed) {
+        remove(tempName);
+        return -1;
+    }
+
+    if (version == 2) {
+        // Same entry size: the records' offsets stay valid
+#ifdef _WIN32
+        remove(store->ledgerName);
+#endif
+        if (rename(tempName, store->ledgerName) != 0) {
+            return -1;
+        }
+    } else {
+        // Record where each account's newest entry moved to; the rename
+        // makes the list visible only once it is complete
+        if ((tempPtr = fopen(remapTempName, "wb")) == NULL) {
+            remove(tempName);
+            return -1;
+        }
+        failed = 0;
+        while ((client = nextRecord(store, &account, &buffer)) != NULL) {
+            if (client->lastEntry != LEDGER_NONE) {
+                remap.acctNum = account;
+                remap.lastEntry = (long long)sizeof(struct ledgerHeader) +
+                    (client->lastEntry - (long long)sizeof(struct ledgerHeader)) /
+                    (long long)sizeof(struct legacyLedgerEntry) * (long long)sizeof(struct ledgerEntry);
+                failed |= fwrite(&remap, sizeof(remap), 1, tempPtr) != 1;
+            }
+        }
+        failed |= fflush(tempPtr) != 0 || fsync(fileno(tempPtr)) != 0;
+        if (fclose(tempPtr) != 0 || failed || rename(remapTempName, remapName) != 0) {
+            remove(remapTempName);
+            remove(tempName);
+            return -1;
+        }
+        if (ledgerRemapRecords(store) != 0) {
+            return -1;
+        }
+    }
+
+    printf("Converted %s to the current format (%lu entries).\n", store->ledgerName, entries);
+    return 0;
+}
+
+// Ledger: apply the remap list to the records and make them durable,
+// then put the converted ledger (if not already there) in place of the old
+// one and drop the list. Every step can be repeated after a crash.
+int ledgerRemapRecords(struct accountStore *store) {
+    struct ledgerRemap remap;
+    struct clientData buffer;
+    struct clientData *client;
+    char tempName[FILENAME_MAX + 8];
+    char remapName[FILENAME_MAX + 8];
+    FILE *remapPtr;
+    FILE *tempPtr;
+
+    snprintf(tempName, sizeof(tempName), "%s.tmp", store->ledgerName);
+    snprintf(remapName, sizeof(remapName), "%s" LEDGER_REMAP_SUFFIX, store->ledgerName);
+    if ((remapPtr = fopen(remapName, "rb")) == NULL) {
+        return -1;
+    }
+    while (fread(&remap, sizeof(remap), 1, remapPtr) == 1) {
+        client = fetchRecord(store, remap.acctNum, &buffer);
+        if (client != NULL && client->acctNum == remap.acctNum && client->lastEntry != remap.lastEntry) {
+            client->lastEntry = remap.lastEntry;
+            commitRecord(store, remap.acctNum, client);
+        }
+    }
+    fclose(remapPtr);
+    storeSync(store);
+    if (store->fp != NULL && fsync(fileno(store->fp)) != 0) {
+        return -1;
+    }
+
+    // Only a complete converted ledger is left under tempName once the list exists
+    if ((tempPtr = fopen(tempName, "rb")) != NULL) {
+        fclose(tempPtr);
+#ifdef _WIN32
+        remove(store->ledgerName);
+#endif
+        if (rename(tempName, store->ledgerName) != 0) {
+            return -1;
+        }
+    }
+    remove(remapName);
+    return 0;
+}
+
+// Helper function: turn a text-dated history entry into the binary form
+void convertLegacyTransaction(const struct legacyTransaction *legacy, struct transaction *txn) {
+    struct tm timeinfo;
+
+    memset(txn, 0, sizeof(*txn));
+    memset(&timeinfo, 0, sizeof(timeinfo));
+    if (sscanf(legacy->date, "%d_%d_%d_%d_%d_%d", &timeinfo.tm_year, &timeinfo.tm_mon,
+               &timeinfo.tm_mday, &timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec) == 6) {
+        timeinfo.tm_year -= 1900;
+        timeinfo.tm_mon -= 1;
+        timeinfo.tm_isdst = -1;
+        txn->timestamp = (long long)mktime(&timeinfo) * 1000000LL;
+    }
+
+    moneyFromDouble(legacy->amount, &txn->amount);
+    moneyFromDouble(legacy->balance_after, &txn->balance_after);
+    if (strcmp(legacy->type, "Initial") == 0) {
+        txn->type = TXN_INITIAL;
+    } else if (strcmp(legacy->type, "Withdraw") == 0) {
+        txn->type = TXN_WITHDRAW;
+    } else {
+        txn->type = TXN_DEPOSIT;
+    }
+}
+
+// Ledger: append a transaction for client and point the record at it.
+// The caller writes the record back as usual.
+int ledgerAppend(struct accountStore *store, struct clientData *client, const struct transaction *txn) {
+    struct ledgerEntry entry;
+    long long started = metricsNow();
+
+    memset(&entry, 0, sizeof(entry));
+    entry.acctNum = client->acctNum;
+    entry.prevEntry = client->lastEntry;
+    entry.txn = *txn;
+
+    if (store->ledgerPtr == NULL ||
+        fseek(store->ledgerPtr, (long)store->ledgerEnd, SEEK_SET) != 0 ||
+        fwrite(&entry, sizeof(entry), 1, store->ledgerPtr) != 1) {
+        return -1;
+    }
+
+    client->lastEntry = store->ledgerEnd;
+    client->transaction_count++;
+    store->ledgerEnd += (long long)sizeof(entry);
+    metricsRecord(METRIC_LEDGER, metricsNow() - started, sizeof(entry), 0);
+    return 0;
+}
+
+// Ledger: append both halves of a transfer, the withdrawal from from and
+// the deposit to to, with one write, and point both records at them. The
+// records are updated one after the other; if only one of them makes it,
+// ledgerRecover finishes the other on the next open.
+int ledgerAppendTransfer(struct accountStore *store, struct clientData *from, struct clientData *to,
+                         money_t amount) {
+    struct ledgerEntry entries[2];
+    long long timestamp = currentTimestamp();
+    long long started = metricsNow();
+
+    memset(entries, 0, sizeof(entries));
+    entries[0].acctNum = from->acctNum;
+    entries[0].transferPeer = to->acctNum;
+    entries[0].prevEntry = from->lastEntry;
+    entries[0].txn.timestamp = timestamp;
+    entries[0].txn.amount = -amount;
+    entries[0].txn.balance_after = from->balance;
+    entries[0].txn.type = TXN_WITHDRAW;
+    entries[1].acctNum = to->acctNum;
+    entries[1].transferPeer = from->acctNum;
+    entries[1].prevEntry = to->lastEntry;
+    entries[1].txn.timestamp = timestamp;
+    entries[1].txn.amount = amount;
+    entries[1].txn.balance_after = to->balance;
+    entries[1].txn.type = TXN_DEPOSIT;
+
+    if (store->ledgerPtr == NULL ||
+        fseek(store->ledgerPtr, (long)store->ledgerEnd, SEEK_SET) != 0 ||
+        fwrite(entries, sizeof(entries[0]), 2, store->ledgerPtr) != 2) {
+        return -1;
+    }
+
+    from->lastEntry = store->ledgerEnd;
+    from->transaction_count++;
+    to->lastEntry = store->ledgerEnd + (long long)sizeof(entries[0]);
+    to->transaction_count++;
+    store->ledgerEnd += (long long)sizeof(entries);
+    metricsRecord(METRIC_LEDGER, metricsNow() - started, sizeof(entries), 0);
+    return 0;
+}
+
+// Ledger: read the entry at offset
+int ledgerRead(struct accountStore *store, long long offset, struct ledgerEntry *entry) {
+    if (store->ledgerPtr == NULL || offset < (long long)sizeof(struct ledgerHeader) ||
+        offset + (long long)sizeof(*entry) > store->ledgerEnd ||
+        fseek(store->ledgerPtr, (long)offset, SEEK_SET) != 0 ||
+        fread(entry, sizeof(*entry), 1, store->ledgerPtr) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Ledger: finish transfers that a crash left half applied. Every transfer
+// written since the last checked offset is looked at; where one record
+// already points at its entry (or both still point at the entry before)
+// the missing side is set from the ledger. A side that is neither has
+// moved on since, and the pair is left alone. Then the records are made
+// durable and the checked offset moves to the end of the ledger.
+int ledgerRecover(struct accountStore *store) {
+    struct ledgerEntry pair[2];
+    long long offset = store->ledgerChecked;
+    unsigned long finished = 0;
+
+    if (store->ledgerPtr == NULL) {
+        return 0;
+    }
+    if (offset < (long long)sizeof(struct ledgerHeader) || offset > store->ledgerEnd) {
+        offset = (long long)sizeof(struct ledgerHeader);
+    }
+    if (fseek(store->ledgerPtr, (long)offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    while (offset + (long long)sizeof(pair[0]) <= store->ledgerEnd &&
+           fread(&pair[0], sizeof(pair[0]), 1, store->ledgerPtr) == 1) {
+        struct clientData buffers[2];
+        struct clientData *records[2];
+        int applied[2], pending[2];
+
+        if (pair[0].transferPeer == 0 || pair[0].txn.type != TXN_WITHDRAW) {
+            offset += (long long)sizeof(pair[0]);
+            continue;
+        }
+        if (offset + (long long)sizeof(pair) > store->ledgerEnd ||
+            fread(&pair[1], sizeof(pair[1]), 1, store->ledgerPtr) != 1) {
+            break;
+        }
+        if (pair[1].acctNum != pair[0].transferPeer || pair[1].transferPeer != pair[0].acctNum ||
+            pair[1].txn.type != TXN_DEPOSIT) {
+            // Not the other half: look at that entry on its own next
+            offset += (long long)sizeof(pair[0]);
+            fseek(store->ledgerPtr, (long)offset, SEEK_SET);
+            continue;
+        }
+        for (int i = 0; i < 2; i++) {
+            long long at = offset + i * (long long)sizeof(pair[0]);
+
+            records[i] = fetchRecord(store, pair[i].acctNum, &buffers[i]);
+            applied[i] = records[i] != NULL && records[i]->acctNum == pair[i].acctNum &&
+                         records[i]->lastEntry == at;
+            pending[i] = records[i] != NULL && records[i]->acctNum == pair[i].acctNum &&
+                         records[i]->lastEntry == pair[i].prevEntry;
+        }
+        if ((applied[0] || pending[0]) && (applied[1] || pending[1]) && (pending[0] || pending[1])) {
+            for (int i = 0; i < 2; i++) {
+                if (pending[i]) {
+                    records[i]->balance = pair[i].txn.balance_after;
+                    records[i]->lastEntry = offset + i * (long long)sizeof(pair[0]);
+                    records[i]->transaction_count++;
+                    commitRecord(store, pair[i].acctNum, records[i]);
+                }
+            }
+            finished++;
+        }
+        offset += (long long)sizeof(pair);
+    }
+
+    if (finished > 0) {
+        printf("Finished %lu interrupted transfer(s) from the ledger.\n", finished);
+    }
+    return ledgerMarkChecked(store);
+}
+
+// Ledger: record that every transfer so far is in the records, once the
+// records are on disk
+int ledgerMarkChecked(struct accountStore *store) {
+    struct ledgerHeader header;
+
+    if (store->ledgerPtr == NULL || store->ledgerChecked == store->ledgerEnd) {
+        return 0;
+    }
+    storeSync(store);
+    if ((store->fp != NULL && fsync(fileno(store->fp)) != 0) ||
+        fseek(store->ledgerPtr, 0, SEEK_SET) != 0 ||
+        fread(&header, sizeof(header), 1, store->ledgerPtr) != 1) {
+        return -1;
+    }
+    header.checkedEnd = store->ledgerEnd;
+    if (fseek(store->ledgerPtr, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, store->ledgerPtr) != 1 ||
+        fflush(store->ledgerPtr) != 0) {
+        return -1;
+    }
+    store->ledgerChecked = store->ledgerEnd;
+    return 0;
+}
+
+// Helper function: file name that goes with a data file name, with the
+// extension replaced (clients_backup_X.dat, ".ldg" -> clients_backup_X.ldg)
+void companionName(char *dest, size_t size, const char *dataName, const char *extension) {
+    const char *dot = strrchr(dataName, '.');
+    const char *slash = strrchr(dataName, '/');
+    int stem = (dot != NULL && (slash == NULL || dot > slash)) ? (int)(dot - dataName)
+                                                                 : (int)strlen(dataName);
+
+    snprintf(dest, size, "%.*s%s", stem, dataName, extension);
+}
+
+// Columns: load clients.col if it was closed cleanly against this exact
+// clients.dat, otherwise rebuild it from the records. The file is then
+// marked in use so a crash forces a rebuild on the next open.
+void columnsOpen(struct accountStore *store) {
+    struct balanceColumns *columns = &store->columns;
+    struct columnHeader header;
+    size_t slots = (size_t)store->header.pageCount * RECORDS_PER_PAGE;
+    FILE *columnPtr;
+    int valid = 0;
+
+    if (columnsReserve(columns, store->header.pageCount) != 0) {
+        puts("Warning: Not enough memory for balance columns.");
+        return;
+    }
+
+    if ((columnPtr = fopen(store->columnName, "rb")) != NULL) {
+        valid = fread(&header, sizeof(header), 1, columnPtr) == 1 &&
+                header.magic == COLUMN_MAGIC && header.version == COLUMN_VERSION &&
+                header.clean == 1 && header.generation == store->openGeneration &&
+                header.pageCount == store->header.pageCount &&
+                fread(columns->active, sizeof(unsigned long long), store->header.pageCount, columnPtr) ==
+                    store->header.pageCount &&
+                fread(columns->balances, sizeof(money_t), slots, columnPtr) == slots;
+        fclose(columnPtr);
+    }
+
+    if (!valid) {
+        memset(columns->active, 0, store->header.pageCount * sizeof(unsigned long long));
+        for (unsigned int page = 0; page < store->header.pageCount; page++) {
+            if (store->pages[page].logicalPage == NO_PAGE) continue;
+            for (unsigned int slot = 0; slot < RECORDS_PER_PAGE; slot++) {
+                struct clientData buffer;
+                unsigned int account = store->pages[page].logicalPage * RECORDS_PER_PAGE + slot + 1;
+                struct clientData *client = fetchRecord(store, account, &buffer);
+
+                if (client != NULL && client->acctNum != 0) {
+                    columns->active[page] |= 1ULL << slot;
+                    columns->balances[(size_t)page * RECORDS_PER_PAGE + slot] = client->balance;
+                }
+            }
+        }
+    }
+    columns->loaded = 1;
+    columnsSave(store, 0);
+}
+
+// Columns: write clients.col. With clean == 0 only the header is written,
+// marking the file as out of date until the next clean save.
+void columnsSave(struct accountStore *store, int clean) {
+    struct balanceColumns *columns = &store->columns;
+    struct columnHeader header = {COLUMN_MAGIC, COLUMN_VERSION, columns->pageCount,
+                                  store->header.generation, (unsigned int)clean, {0}};
+    FILE *columnPtr;
+
+    if ((columnPtr = fopen(store->columnName, clean ? "wb" : "rb+")) == NULL &&
+        (columnPtr = fopen(store->columnName, "wb")) == NULL) {
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, columnPtr);
+    if (clean) {
+        fwrite(columns->active, sizeof(unsigned long long), columns->pageCount, columnPtr);
+        fwrite(columns->balances, sizeof(money_t), (size_t)columns->pageCount * RECORDS_PER_PAGE, columnPtr);
+    }
+    fclose(columnPtr);
+}
+
+// Columns: make room for pageCount pages (new slots start inactive)
+int columnsReserve(struct balanceColumns *columns, unsigned int pageCount) {
+    money_t *balances;
+    unsigned long long *active;
+
+    if (pageCount <= columns->pageCount && columns->balances != NULL) {
+        return 0;
+    }
+    balances = realloc(columns->balances, ((size_t)pageCount * RECORDS_PER_PAGE + 1) * sizeof(money_t));
+    if (balances == NULL) {
+        return -1;
+    }
+    columns->balances = balances;
+    active = realloc(columns->active, ((size_t)pageCount + 1) * sizeof(unsigned long long));
+    if (active == NULL) {
+        return -1;
+    }
+    columns->active = active;
+    for (unsigned int page = columns->pageCount; page < pageCount; page++) {
+        active[page] = 0;
+        memset(&balances[(size_t)page * RECORDS_PER_PAGE], 0, RECORDS_PER_PAGE * sizeof(money_t));
+    }
+    columns->pageCount = pageCount;
+    return 0;
+}
+
+// Columns: mirror a record write (a blank record clears the slot)
+void columnsUpdate(struct accountStore *store, unsigned int account, const struct clientData *client) {
+    struct balanceColumns *columns = &store->columns;
+    unsigned int page = store->directory[(account - 1) / RECORDS_PER_PAGE];
+    unsigned int slot = (account - 1) % RECORDS_PER_PAGE;
+
+    if (!columns->loaded || page >= columns->pageCount) {
+        return;
+    }
+    if (client->acctNum != 0) {
+        columns->active[page] |= 1ULL << slot;
+        columns->balances[(size_t)page * RECORDS_PER_PAGE + slot] = client->balance;
+    } else {
+        columns->active[page] &= ~(1ULL << slot);
+        columns->balances[(size_t)page * RECORDS_PER_PAGE + slot] = 0;
+    }
+}
+
+// Backup: load the dirty page marks from clients.bkp if it was closed
+// cleanly against this exact clients.dat; otherwise nothing is known about
+// what changed since the last backup and the next one must be full. The
+// file is then marked in use until the next clean close.
+void backupStateOpen(struct accountStore *store) {
+    struct backupState *backup = &store->backup;
+    struct backupStateHeader header;
+    FILE *statePtr;
+    int valid = 0;
+
+    if (backupReserve(backup, store->header.pageCount) != 0) {
+        puts("Warning: Not enough memory for backup tracking.");
+        return;
+    }
+
+    if ((statePtr = fopen(store->backupStateName, "rb")) != NULL) {
+        valid = fread(&header, sizeof(header), 1, statePtr) == 1 &&
+                header.magic == BACKUP_MAGIC && header.version == BACKUP_VERSION &&
+                header.clean == 1 && header.generation == store->openGeneration &&
+                header.pageCount == store->header.pageCount &&
+                header.ledgerSize <= store->ledgerEnd &&
+                fread(backup->dirty, 1, header.pageCount, statePtr) == header.pageCount;
+        fclose(statePtr);
+    }
+
+    if (valid) {
+        backup->ledgerSize = header.ledgerSize;
+        snprintf(backup->lastBackup, sizeof(backup->lastBackup), "%.*s",
+                 BACKUP_NAME_LEN - 1, header.lastBackup);
+    } else {
+        memset(backup->dirty, 0, backup->pageCount);
+        backup->ledgerSize = 0;
+        backup->lastBackup[0] = '\0';
+    }
+    backup->loaded = 1;
+    backupStateSave(store, 0);
+}
+
+// Backup: write clients.bkp. With clean == 0 the marks are left out and
+// the file only says it is in use.
+void backupStateSave(struct accountStore *store, int clean) {
+    struct backupState *backup = &store->backup;
+    struct backupStateHeader header;
+    FILE *statePtr;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = BACKUP_MAGIC;
+    header.version = BACKUP_VERSION;
+    header.generation = store->header.generation;
+    header.clean = (unsigned int)clean;
+    header.pageCount = backup->pageCount;
+    header.ledgerSize = backup->ledgerSize;
+    memcpy(header.lastBackup, backup->lastBackup, BACKUP_NAME_LEN);
+
+    if ((statePtr = fopen(store->backupStateName, "wb")) == NULL) {
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, statePtr);
+    if (clean) {
+        fwrite(backup->dirty, 1, backup->pageCount, statePtr);
+    }
+    fclose(statePtr);
+}
+
+// Backup: make room for marks on pageCount pages (new pages start clean;
+// allocatePage writes their header, which marks them)
+int backupReserve(struct backupState *backup, unsigned int pageCount) {
+    unsigned char *dirty;
+
+    if (pageCount <= backup->pageCount && backup->dirty != NULL) {
+        return 0;
+    }
+    dirty = realloc(backup->dirty, (size_t)pageCount + 1);
+    if (dirty == NULL) {
+        return -1;
+    }
+    memset(dirty + backup->pageCount, 0, (size_t)pageCount + 1 - backup->pageCount);
+    backup->dirty = dirty;
+    backup->pageCount = pageCount;
+    return 0;
+}
+
+// Backup: mark the pages a write touches. The store header is not tracked;
+// every incremental backup carries it. Server threads only touch pages
+// under their stripe lock, and each page has its own byte.
+void backupMarkDirty(struct accountStore *store, long offset, size_t size) {
+    struct backupState *backup = &store->backup;
+    long pagesStart = (long)sizeof(struct storeHeader);
+    long end = offset + (long)size;
+
+    if (!backup->loaded || end <= pagesStart) {
+        return;
+    }
+    for (long page = (offset < pagesStart ? 0 : (offset - pagesStart) / (long)PAGE_BYTES);
+         page <= (end - 1 - pagesStart) / (long)PAGE_BYTES && page < (long)backup->pageCount; page++) {
+        backup->dirty[page] = 1;
+    }
+}
+
+// Backup: clients.dat and the ledger now match lastBackup exactly
+void backupReset(struct accountStore *store, const char *lastBackup) {
+    struct backupState *backup = &store->backup;
+
+    if (!backup->loaded) {
+        return;
+    }
+    memset(backup->dirty, 0, backup->pageCount);
+    backup->ledgerSize = store->ledgerEnd;
+    snprintf(backup->lastBackup, sizeof(backup->lastBackup), "%s", lastBackup);
+}
+
+// Backup: write the pages changed since the last backup to name and the
+// ledger entries appended since then to ledgerName. The caller has synced
+// the store, so the file and the ledger hold every change.
+int writeIncrement(struct accountStore *store, const char *name, const char *ledgerName,
+                   unsigned int *pagesWritten) {
+    struct backupState *backup = &store->backup;
+    struct incrementHeader header;
+    unsigned char *image = malloc(PAGE_BYTES);
+    FILE *outPtr;
+    FILE *ledgerPtr;
+    int failed = 0;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = INCREMENT_MAGIC;
+    header.version = BACKUP_VERSION;
+    header.ledgerStart = backup->ledgerSize;
+    header.ledgerEnd = store->ledgerEnd;
+    memcpy(header.parent, backup->lastBackup, BACKUP_NAME_LEN);
+    header.store = store->header;
+    for (unsigned int page = 0; page < backup->pageCount; page++) {
+        if (backup->dirty[page]) header.dirtyCount++;
+    }
+
+    if (image == NULL || (outPtr = fopen(name, "wb")) == NULL) {
+        free(image);
+        return -1;
+    }
+    failed = fwrite(&header, sizeof(header), 1, outPtr) != 1;
+    for (unsigned int page = 0; page < backup->pageCount && !failed; page++) {
+        if (!backup->dirty[page]) continue;
+
+        if (store->map != NULL) {
+            memcpy(image, store->map + pageOffset(page), PAGE_BYTES);
+        } else if (fseek(store->fp, pageOffset(page), SEEK_SET) != 0 ||
+                   fread(image, PAGE_BYTES, 1, store->fp) != 1) {
+            failed = 1;
+            break;
+        }
+        failed = fwrite(&page, sizeof(page), 1, outPtr) != 1 ||
+                 fwrite(image, PAGE_BYTES, 1, outPtr) != 1;
+    }
+    store->filePos = -1;
+    free(image);
+    if (fclose(outPtr) != 0 || failed) {
+        return -1;
+    }
+
+    // The ledger is append-only: the new entries are everything past
+    // the size covered by the previous backup
+    if ((ledgerPtr = fopen(store->ledgerName, "rb")) == NULL) {
+        return -1;
+    }
+    if (fseek(ledgerPtr, (long)header.ledgerStart, SEEK_SET) != 0 ||
+        (outPtr = fopen(ledgerName, "wb")) == NULL) {
+        fclose(ledgerPtr);
+        return -1;
+    }
+    failed = copyFileBlocks(ledgerPtr, outPtr) != 0;
+    fclose(ledgerPtr);
+    if (fclose(outPtr) != 0 || failed) {
+        return -1;
+    }
+    *pagesWritten = header.dirtyCount;
+    return 0;
+}
+
+// Backup: list the backups a restore of name replays, newest first: name,
+// its parent, and so on back to a full backup. Returns the count, or -1
+// if a file is missing or the chain does not end in a full backup.
+int backupChain(const char *name, char chain[][BACKUP_NAME_LEN], int max) {
+    char current[BACKUP_NAME_LEN];
+    int count = 0;
+
+    snprintf(current, sizeof(current), "%s", name);
+    while (count < max) {
+        struct incrementHeader header;
+        FILE *fp = fopen(current, "rb");
+        int increment;
+
+        if (fp == NULL) {
+            return -1;
+        }
+        memcpy(chain[count++], current, BACKUP_NAME_LEN);
+        increment = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == INCREMENT_MAGIC;
+        fclose(fp);
+        if (!increment) {
+            return count;    // a full backup (any clients.dat layout) ends the chain
+        }
+        if (header.version != BACKUP_VERSION) {
+            return -1;
+        }
+        snprintf(current, sizeof(current), "%.*s", BACKUP_NAME_LEN - 1, header.parent);
+    }
+    return -1;
+}
+
+// Backup: apply one incremental backup to the restored data file and ledger
+int applyIncrement(const char *name, const char *dataName, const char *ledgerName) {
+    struct incrementHeader header;
+    char incrementLedger[BACKUP_NAME_LEN];
+    unsigned char *image = malloc(PAGE_BYTES);
+    FILE *inPtr = fopen(name, "rb");
+    FILE *outPtr = fopen(dataName, "rb+");
+    int failed = image == NULL || inPtr == NULL || outPtr == NULL ||
+                 fread(&header, sizeof(header), 1, inPtr) != 1;
+
+    for (unsigned int i = 0; !failed && i < header.dirtyCount; i++) {
+        unsigned int page;
+
+        failed = fread(&page, sizeof(page), 1, inPtr) != 1 ||
+                 fread(image, PAGE_BYTES, 1, inPtr) != 1 ||
+                 fseek(outPtr, pageOffset(page), SEEK_SET) != 0 ||
+                 fwrite(image, PAGE_BYTES, 1, outPtr) != 1;
+    }
+    // The header last: its page count covers every page written above
+    if (!failed) {
+        failed = fseek(outPtr, 0, SEEK_SET) != 0 ||
+                 fwrite(&header.store, sizeof(header.store), 1, outPtr) != 1;
+    }
+    if (outPtr != NULL && fclose(outPtr) != 0) {
+        failed = 1;
+    }
+    if (inPtr != NULL) {
+        fclose(inPtr);
+    }
+    free(image);
+    if (failed) {
+        return -1;
+    }
+
+    if (header.ledgerEnd > header.ledgerStart) {
+        companionName(incrementLedger, sizeof(incrementLedger), name, LEDGER_EXTENSION);
+        inPtr = fopen(incrementLedger, "rb");
+        outPtr = fopen(ledgerName, "rb+");
+        failed = inPtr == NULL || outPtr == NULL ||
+                 fseek(outPtr, (long)header.ledgerStart, SEEK_SET) != 0;
+        if (!failed) {
+            failed = copyFileBlocks(inPtr, outPtr) != 0;
+        }
+        if (outPtr != NULL && fclose(outPtr) != 0) {
+            failed = 1;
+        }
+        if (inPtr != NULL) {
+            fclose(inPtr);
+        }
+    }
+    return failed ? -1 : 0;
+}
+
+// Backup: timestamped backup file name, e.g. clients_backup_2024_01_15_10_30_45.dat
+void backupFileName(char *name, size_t size, const char *prefix, const char *extension) {
+    char dateTime[30];
+
+    getCurrentDateTime(dateTime);
+    snprintf(name, size, "%s_%s.%s", prefix, dateTime, extension);
+
+    // Replace spaces and colons with underscores in the filename
+    for (int i = 0; name[i]; i++) {
+        if (name[i] == ' ' || name[i] == ':') {
+            name[i] = '_';
+        }
+    }
+}
+
+// Backup: start a full backup on a background thread. The caller makes
+// sure no record is being changed while this runs (the menu loop between
+// commands, or the server holding every stripe), so the backup starts
+// from a consistent state; it is also the base for the next incremental
+// backup from here on.
+int onlineBackupStart(struct accountStore *store, const char *name, const char *ledgerName) {
+    struct onlineBackup *online = &store->online;
+    FILE *existing;
+
+    if (online->active) {
+        return -1;
+    }
+    if ((existing = fopen(name, "rb")) != NULL) {
+        fclose(existing);    // names have one-second resolution; never overwrite a backup
+        return -1;
+    }
+    storeSync(store);
+    memset(online, 0, sizeof(*online));
+    snprintf(online->name, sizeof(online->name), "%s", name);
+    snprintf(online->ledgerName, sizeof(online->ledgerName), "%s", ledgerName);
+    snprintf(online->sourceLedger, sizeof(online->sourceLedger), "%s", store->ledgerName);
+    online->header = store->header;
+    online->ledgerSize = store->ledgerEnd;
+    online->copied = calloc((size_t)online->header.pageCount + 1, 1);
+    online->source = fopen(store->fileName, "rb");
+    online->out = fopen(name, "wb");
+#ifdef HAVE_REFLINK
+    // Filesystems with shared extents clone the whole file at once: the
+    // clone is the snapshot and only the ledger is left to copy
+    if (online->copied != NULL && online->source != NULL && online->out != NULL &&
+        ioctl(fileno(online->out), FICLONE, fileno(online->source)) == 0) {
+        memset(online->copied, 1, online->header.pageCount);
+    }
+#endif
+    if (online->copied == NULL || online->source == NULL || online->out == NULL ||
+        fwrite(&online->header, sizeof(online->header), 1, online->out) != 1 ||
+        fflush(online->out) != 0) {
+        free(online->copied);
+        if (online->source != NULL) fclose(online->source);
+        if (online->out != NULL) fclose(online->out);
+        memset(online, 0, sizeof(*online));
+        return -1;
+    }
+    backupReset(store, name);
+    online->active = 1;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&online->lock, NULL);
+    if (startThread(&online->thread, onlineBackupWorker, online) == 0) {
+        return 0;
+    }
+    pthread_mutex_destroy(&online->lock);
+#endif
+    // No thread: copy everything now; the store is idle anyway
+    onlineBackupWorker(online);
+    online->active = -1;
+    return 0;
+}
+
+// Backup: copy every page the writers have not copied yet, then the
+// ledger up to its size at the start (entries after that are not referenced
+// by any record in the backup)
+void *onlineBackupWorker(void *arg) {
+    struct onlineBackup *online = arg;
+    FILE *inPtr;
+    FILE *outPtr;
+    char *block;
+    long long remaining = online->ledgerSize;
+    int failed = 0;
+
+    for (unsigned int page = 0; page < online->header.pageCount; page++) {
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&online->lock);
+#endif
+        if (!online->copied[page] && !online->failed && onlineBackupCopyPage(online, page) != 0) {
+            online->failed = 1;
+        }
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&online->lock);
+#endif
+    }
+
+    inPtr = fopen(online->sourceLedger, "rb");
+    outPtr = fopen(online->ledgerName, "wb");
+    block = malloc(COPY_BLOCK);
+    failed = inPtr == NULL || outPtr == NULL || block == NULL;
+    while (!failed && remaining > 0) {
+        size_t want = remaining < COPY_BLOCK ? (size_t)remaining : COPY_BLOCK;
+
+        failed = fread(block, 1, want, inPtr) != want || fwrite(block, 1, want, outPtr) != want;
+        remaining -= (long long)want;
+    }
+    if (outPtr != NULL && fclose(outPtr) != 0) {
+        failed = 1;
+    }
+    if (inPtr != NULL) {
+        fclose(inPtr);
+    }
+    free(block);
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&online->lock);
+#endif
+    if (fclose(online->out) != 0) {
+        failed = 1;
+    }
+    fclose(online->source);
+    online->out = online->source = NULL;
+    online->failed |= failed;
+    online->finished = 1;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&online->lock);
+#endif
+    return NULL;
+}
+
+// Backup: copy one page, as it is in the file now, to the same offset in
+// the backup (called with the lock held)
+int onlineBackupCopyPage(struct onlineBackup *online, unsigned int page) {
+    static unsigned char image[PAGE_BYTES];   // only used under the lock
+
+    online->copied[page] = 1;
+#ifdef HAVE_COPY_FILE_RANGE
+    {
+        // Copied inside the kernel; filesystems that cannot fall back below
+        loff_t inOffset = pageOffset(page), outOffset = pageOffset(page);
+
+        if (copy_file_range(fileno(online->source), &inOffset, fileno(online->out), &outOffset,
+                            PAGE_BYTES, 0) == (ssize_t)PAGE_BYTES) {
+            return 0;
+        }
+    }
+#endif
+    if (fseek(online->source, pageOffset(page), SEEK_SET) != 0 ||
+        fread(image, PAGE_BYTES, 1, online->source) != 1 ||
+        fseek(online->out, pageOffset(page), SEEK_SET) != 0 ||
+        fwrite(image, PAGE_BYTES, 1, online->out) != 1 ||
+        fflush(online->out) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Backup: called before bytes of clients.dat change. Pages of the backup
+// that the thread has not reached are copied first, with their old content.
+void onlineBackupPreserve(struct accountStore *store, long offset, size_t size) {
+    struct onlineBackup *online = &store->online;
+    long pagesStart = (long)sizeof(struct storeHeader);
+    long end = offset + (long)size;
+
+    if (online->active != 1 || end <= pagesStart) {
+        return;
+    }
+    for (long page = (offset < pagesStart ? 0 : (offset - pagesStart) / (long)PAGE_BYTES);
+         page <= (end - 1 - pagesStart) / (long)PAGE_BYTES && page < (long)online->header.pageCount; page++) {
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&online->lock);
+#endif
+        if (!online->copied[page] && !online->failed) {
+            if (onlineBackupCopyPage(online, (unsigned int)page) != 0) {
+                online->failed = 1;
+            }
+            online->pagesPreserved++;
+        }
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&online->lock);
+#endif
+    }
+}
+
+// Backup: collect a finished online backup and report it. With wait set,
+// waits for a running one. Returns 1 if a backup was collected, 0 if none
+// is running or it is still copying. Same caller rules as onlineBackupStart.
+int onlineBackupFinish(struct accountStore *store, int wait) {
+    struct onlineBackup *online = &store->online;
+
+    if (online->active == 0) {
+        return 0;
+    }
+#ifdef HAVE_PTHREAD
+    if (online->active == 1) {
+        int finished;
+
+        pthread_mutex_lock(&online->lock);
+        finished = online->finished;
+        pthread_mutex_unlock(&online->lock);
+        if (!finished && !wait) {
+            return 0;
+        }
+        pthread_join(online->thread, NULL);
+        pthread_mutex_destroy(&online->lock);
+    }
+#else
+    (void)wait;
+#endif
+
+    if (online->failed) {
+        printf("Error: Background backup %s failed.\n", online->name);
+        remove(online->name);
+        remove(online->ledgerName);
+        if (strcmp(store->backup.lastBackup, online->name) == 0) {
+            store->backup.lastBackup[0] = '\0';   // the next backup must be a full one
+        }
+    } else {
+        printf("Background backup completed: %s (ledger: %s), %u pages, %u copied ahead of updates\n",
+               online->name, online->ledgerName, online->header.pageCount, online->pagesPreserved);
+    }
+    free(online->copied);
+    memset(online, 0, sizeof(*online));
+    return 1;
+}
+
+// Columns: count, exact total, min and max over the active slots. Page
+// ranges are summarized in parallel and merged in page order, so ties go
+// to the same account as a single pass would pick.
+void summarizeBalances(const struct balanceColumns *columns, const struct pageHeader *pages,
+                       struct balanceSummary *summary) {
+    struct summaryScan scan;
+    struct scanJob job = {
+        .scanChunk = summarizeChunk, .mergeChunk = mergeSummaryChunk,
+        .partialSize = sizeof(struct summaryChunk), .context = &scan
+    };
+    long long highSum, lowSum;
+
+    memset(summary, 0, sizeof(*summary));
+    if (!columns->loaded) {
+        return;
+    }
+
+    memset(&scan, 0, sizeof(scan));
+    scan.columns = columns;
+    scan.pages = pages;
+    if (parallelScan(&job, columns->pageCount) != 0) {
+        // No memory for per-chunk results: one pass on this thread
+        summarizeChunk(&job, 0, columns->pageCount, &scan.result);
+    }
+    *summary = scan.result.summary;
+    highSum = scan.result.highSum;
+    lowSum = scan.result.lowSum;
+
+    // With at most 10^8 accounts both sums are far from overflowing
+    if (highSum > (MONEY_LIMIT >> 32) + 1 || highSum < -(MONEY_LIMIT >> 32) - 1) {
+        summary->overflow = 1;
+    } else {
+        summary->total = highSum * 4294967296LL + lowSum;
+        summary->overflow = summary->total > MONEY_LIMIT || summary->total < -MONEY_LIMIT;
+    }
+}
+
+// Columns: summarize pages [begin, end). Each page is reduced over its 64
+// slots with masks instead of branches, which compilers turn into SIMD
+// code at -O2/-O3. The total is kept as separate sums of the high and low
+// 32-bit halves so no partial sum can overflow; only pages that beat the
+// running min or max are searched for the slot that holds it.
+void summarizeChunk(struct scanJob *job, size_t begin, size_t end, void *partial) {
+    const struct summaryScan *scan = job->context;
+    const struct balanceColumns *columns = scan->columns;
+    struct summaryChunk *chunk = partial;
+    struct balanceSummary *summary = &chunk->summary;
+
+    for (size_t page = begin; page < end; page++) {
+        unsigned long long word = columns->active[page];
+        const money_t *balances = &columns->balances[page * RECORDS_PER_PAGE];
+        long long pageHigh = 0, pageLow = 0;
+        money_t pageMax = -MONEY_LIMIT - 1, pageMin = MONEY_LIMIT + 1;
+
+        if (word == 0) continue;
+        summary->count += countBits(word);
+
+        // 64-bit lanes throughout (including the index) so the loop vectorizes
+        for (unsigned long long slot = 0; slot < RECORDS_PER_PAGE; slot++) {
+            long long mask = -(long long)((word >> slot) & 1);   // all ones if active
+            money_t value = balances[slot];
+            money_t forMax = mask ? value : -MONEY_LIMIT - 1;
+            money_t forMin = mask ? value : MONEY_LIMIT + 1;
+
+            pageHigh += (value >> 32) & mask;   // arithmetic shift keeps the sign
+            pageLow += (value & 0xFFFFFFFFLL) & mask;
+            pageMax = forMax > pageMax ? forMax : pageMax;
+            pageMin = forMin < pageMin ? forMin : pageMin;
+        }
+        chunk->highSum += pageHigh;
+        chunk->lowSum += pageLow;
+
+        // Locate the slot only when this page sets a new extreme
+        if (!chunk->found || pageMax > summary->highest || pageMin < summary->lowest) {
+            for (int slot = 0; slot < RECORDS_PER_PAGE; slot++) {
+                unsigned int account = scan->pages[page].logicalPage * RECORDS_PER_PAGE + slot + 1;
+
+                if (!((word >> slot) & 1)) continue;
+                if (!chunk->found || balances[slot] > summary->highest) {
+                    summary->highest = balances[slot];
+                    summary->highestAcct = account;
+                }
+                if (!chunk->found || balances[slot] < summary->lowest) {
+                    summary->lowest = balances[slot];
+                    summary->lowestAcct = account;
+                }
+                chunk->found = 1;
+            }
+        }
+    }
+}
+
+// Columns: fold one chunk into the running summary; earlier pages win ties
+void mergeSummaryChunk(struct scanJob *job, void *partial) {
+    struct summaryScan *scan = job->context;
+    struct summaryChunk *into = &scan->result;
+    const struct summaryChunk *chunk = partial;
+
+    into->summary.count += chunk->summary.count;
+    into->highSum += chunk->highSum;
+    into->lowSum += chunk->lowSum;
+    if (!chunk->found) {
+        return;
+    }
+    if (!into->found || chunk->summary.highest > into->summary.highest) {
+        into->summary.highest = chunk->summary.highest;
+        into->summary.highestAcct = chunk->summary.highestAcct;
+    }
+    if (!into->found || chunk->summary.lowest < into->summary.lowest) {
+        into->summary.lowest = chunk->summary.lowest;
+        into->summary.lowestAcct = chunk->summary.lowestAcct;
+    }
+    into->found = 1;
+}
+
+// Helper function: number of set bits in a word
+unsigned int countBits(unsigned long long word) {
+    unsigned int count = 0;
+
+    while (word != 0) {
+        word &= word - 1;
+        count++;
+    }
+    return count;
+}
+
+// Scan: run job->scanChunk over [0, itemCount) on up to scanThreadCount()
+// threads (the caller included), then merge the partials in chunk order.
+// Returns -1 if the partial results cannot be allocated.
+int parallelScan(struct scanJob *job, size_t itemCount) {
+    unsigned int threads = scanThreadCount();
+
+    job->itemCount = itemCount;
+    job->nextChunk = 0;
+    if (itemCount == 0) {
+        return 0;
+    }
+    job->chunkCount = (size_t)threads * SCAN_CHUNKS_PER_THREAD;
+    if (job->chunkCount > itemCount) {
+        job->chunkCount = itemCount;
+    }
+    job->chunkSize = (itemCount + job->chunkCount - 1) / job->chunkCount;
+    job->chunkCount = (itemCount + job->chunkSize - 1) / job->chunkSize;
+    if ((job->partials = calloc(job->chunkCount, job->partialSize)) == NULL) {
+        return -1;
+    }
+    if (threads > job->chunkCount) {
+        threads = (unsigned int)job->chunkCount;
+    }
+
+#ifdef HAVE_PTHREAD
+    {
+        pthread_t workers[SCAN_MAX_THREADS];
+        unsigned int started;
+
+        pthread_mutex_init(&job->lock, NULL);
+        // If a thread cannot be started, the others pick up its chunks
+        for (started = 0; started + 1 < threads; started++) {
+            if (startThread(&workers[started], scanWorker, job) != 0) break;
+        }
+        scanWorker(job);
+        for (unsigned int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        pthread_mutex_destroy(&job->lock);
+    }
+#else
+    (void)threads;
+    scanWorker(job);
+#endif
+
+    for (size_t chunk = 0; chunk < job->chunkCount; chunk++) {
+        job->mergeChunk(job, job->partials + chunk * job->partialSize);
+    }
+    free(job->partials);
+    job->partials = NULL;
+    return 0;
+}
+
+// Scan: claim chunks until none are left
+void *scanWorker(void *arg) {
+    struct scanJob *job = arg;
+
+    for (;;) {
+        size_t chunk, begin, end;
+
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&job->lock);
+#endif
+        chunk = job->nextChunk++;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&job->lock);
+#endif
+        if (chunk >= job->chunkCount) break;
+
+        begin = chunk * job->chunkSize;
+        end = begin + job->chunkSize < job->itemCount ? begin + job->chunkSize : job->itemCount;
+        job->scanChunk(job, begin, end, job->partials + chunk * job->partialSize);
+    }
+    return NULL;
+}
+
+// Scan: threads to use, --threads or the number of online processors
+unsigned int scanThreadCount(void) {
+    long online = 1;
+
+    if (scanThreads > 0) {
+        return scanThreads;
+    }
+#ifdef HAVE_PTHREAD
+    online = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (online < 1) online = 1;
+    if (online > SCAN_MAX_THREADS) online = SCAN_MAX_THREADS;
+    return (unsigned int)online;
+}
+
+// Scan: write a line for every account (term NULL) or every account whose
+// name contains term, in account order. Returns -1 if some pages could
+// not be read or memory ran out.
+int scanRecords(struct accountStore *store, const char *term, int format, FILE *out, unsigned long *lines) {
+    struct recordScan scan = {store, term, format, out, NULL, 0, 0};
+    int status = runRecordScan(&scan);
+
+    if (lines != NULL) {
+        *lines = scan.lines;
+    }
+    return status;
+}
+
+// Scan: run a record scan over every logical page. Chunks are ranges of
+// pages; their output is merged in account order.
+int runRecordScan(struct recordScan *scan) {
+    struct scanJob job = {
+        .scanChunk = scanRecordChunk, .mergeChunk = mergeRecordChunk,
+        .partialSize = sizeof(struct textBuffer), .context = scan
+    };
+
+    // Workers read the file through their own handles
+    if (scan->store->map == NULL) {
+        fflush(scan->store->fp);
+    }
+    if (parallelScan(&job, scan->store->directorySize) != 0) {
+        return -1;
+    }
+    return scan->failed ? -1 : 0;
+}
+
+// Scan: format the matching accounts of logical pages [begin, end)
+void scanRecordChunk(struct scanJob *job, size_t begin, size_t end, void *partial) {
+    struct recordScan *scan = job->context;
+    struct textBuffer *text = partial;
+    struct clientData records[RECORDS_PER_PAGE];
+    FILE *fp = NULL;
+    char line[EXPORT_LINE_MAX];
+
+    for (size_t logicalPage = begin; logicalPage < end && !text->failed; logicalPage++) {
+        const struct clientData *client;
+
+        if (scan->store->directory[logicalPage] == NO_PAGE) continue;
+        if ((client = scanPageRecords(scan->store, (unsigned int)logicalPage, &fp, records)) == NULL) {
+            text->failed = 1;
+            break;
+        }
+
+        for (int slot = 0; slot < RECORDS_PER_PAGE; slot++, client++) {
+            if (client->acctNum == 0 || (scan->term != NULL && !nameMatches(client, scan->term))) continue;
+            if (textAppend(text, line, formatRecord(line, client, scan->format)) != 0) {
+                text->failed = 1;
+                break;
+            }
+            text->lines++;
+        }
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+}
+
+// Scan: write one chunk's output and release it
+void mergeRecordChunk(struct scanJob *job, void *partial) {
+    struct recordScan *scan = job->context;
+    struct textBuffer *text = partial;
+
+    fwrite(text->data, 1, text->length, scan->out);
+    scan->lines += text->lines;
+    scan->failed |= text->failed;
+    free(text->data);
+}
+
+// Scan: collect the accounts whose name contains scan->term into
+// scan->matches, in account order. Returns -1 if the scan could not run.
+int runSearchScan(struct recordScan *scan) {
+    struct scanJob job = {
+        .scanChunk = searchRecordChunk, .mergeChunk = mergeSearchChunk,
+        .partialSize = sizeof(struct recordArray), .context = scan
+    };
+
+    if (scan->store->map == NULL) {
+        fflush(scan->store->fp);
+    }
+    return parallelScan(&job, scan->store->directorySize);
+}
+
+// Scan: copy the matching accounts of logical pages [begin, end)
+void searchRecordChunk(struct scanJob *job, size_t begin, size_t end, void *partial) {
+    struct recordScan *scan = job->context;
+    struct recordArray *found = partial;
+    struct clientData records[RECORDS_PER_PAGE];
+    FILE *fp = NULL;
+
+    for (size_t logicalPage = begin; logicalPage < end && found->status == ACCOUNT_OK; logicalPage++) {
+        const struct clientData *client;
+
+        if (scan->store->directory[logicalPage] == NO_PAGE) continue;
+        if ((client = scanPageRecords(scan->store, (unsigned int)logicalPage, &fp, records)) == NULL) {
+            found->status = ACCOUNT_IO_ERROR;
+            break;
+        }
+        for (int slot = 0; slot < RECORDS_PER_PAGE && found->status == ACCOUNT_OK; slot++, client++) {
+            if (client->acctNum != 0 && nameMatches(client, scan->term)) {
+                recordAppend(found, client);
+            }
+        }
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+}
+
+// Scan: add one chunk's matches to the result and release them
+void mergeSearchChunk(struct scanJob *job, void *partial) {
+    struct recordArray *matches = ((struct recordScan *)job->context)->matches;
+    struct recordArray *found = partial;
+
+    for (size_t i = 0; i < found->count && matches->status == ACCOUNT_OK; i++) {
+        recordAppend(matches, &found->records[i]);
+    }
+    if (matches->status == ACCOUNT_OK) {
+        matches->status = found->status;
+    }
+    free(found->records);
+}
+
+// Scan: the records of one logical page, straight from the mapping or read
+// as a whole page through the chunk's own handle (the shared stdio handle
+// has a single file position). NULL if the page cannot be read.
+const struct clientData *scanPageRecords(struct accountStore *store, unsigned int logicalPage,
+                                         FILE **fp, struct clientData *records) {
+    long offset = pageOffset(store->directory[logicalPage]) + (long)sizeof(struct pageHeader);
+
+    if (store->map != NULL) {
+        return (const struct clientData *)(store->map + offset);
+    }
+    if (*fp == NULL && (*fp = fopen(store->fileName, "rb")) == NULL) {
+        return NULL;
+    }
+    if (fseek(*fp, offset, SEEK_SET) != 0 ||
+        fread(records, sizeof(struct clientData), RECORDS_PER_PAGE, *fp) != RECORDS_PER_PAGE) {
+        return NULL;
+    }
+    return records;
+}
+
+// Export: format name given to --export, -1 if unknown
+int parseExportFormat(const char *name) {
+    if (strcmp(name, "text") == 0 || strcmp(name, "fixed") == 0) return EXPORT_FIXED;
+    if (strcmp(name, "csv") == 0) return EXPORT_CSV;
+    if (strcmp(name, "jsonl") == 0) return EXPORT_JSONL;
+    return -1;
+}
+
+// Export: one account as a line of the given format; line holds at least
+// EXPORT_LINE_MAX bytes. The fixed layout matches
+// "%-6u%-16s%-11s%10.2f\n" exactly.
+size_t formatRecord(char *line, const struct clientData *client, int format) {
+    size_t lastLength = fieldLength(client->lastName, LAST_NAME_LEN);
+    size_t firstLength = fieldLength(client->firstName, FIRST_NAME_LEN);
+    char number[24];
+    char money[32];
+    size_t numberLength = formatUnsigned(number, client->acctNum);
+    size_t moneyLength = formatMoney(money, client->balance);
+    char *p = line;
+
+    switch (format) {
+    case EXPORT_CSV:
+        memcpy(p, number, numberLength);
+        p += numberLength;
+        *p++ = ',';
+        p += formatCsvField(p, client->lastName, lastLength);
+        *p++ = ',';
+        p += formatCsvField(p, client->firstName, firstLength);
+        *p++ = ',';
+        memcpy(p, money, moneyLength);
+        p += moneyLength;
+        break;
+    case EXPORT_JSONL:
+        memcpy(p, "{\"acct\":", 8);
+        p += 8;
+        memcpy(p, number, numberLength);
+        p += numberLength;
+        memcpy(p, ",\"last_name\":", 13);
+        p += 13;
+        p += formatJsonString(p, client->lastName, lastLength);
+        memcpy(p, ",\"first_name\":", 14);
+        p += 14;
+        p += formatJsonString(p, client->firstName, firstLength);
+        memcpy(p, ",\"balance\":", 11);
+        p += 11;
+        memcpy(p, money, moneyLength);
+        p += moneyLength;
+        *p++ = '}';
+        break;
+    default:
+        p += formatPadded(p, number, numberLength, 6, 0);
+        p += formatPadded(p, client->lastName, lastLength, 16, 0);
+        p += formatPadded(p, client->firstName, firstLength, 11, 0);
+        p += formatPadded(p, money, moneyLength, 10, 1);
+        break;
+    }
+    *p++ = '\n';
+    return (size_t)(p - line);
+}
+
+// Export: decimal digits of value
+size_t formatUnsigned(char *dest, unsigned long long value) {
+    char digits[20];
+    size_t count = 0;
+
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    for (size_t i = 0; i < count; i++) {
+        dest[i] = digits[count - 1 - i];
+    }
+    return count;
+}
+
+// Export: cents as a fixed-point amount with two decimals ("-12.05"),
+// the same text %.2f gives for the amount in currency units
+size_t formatMoney(char *dest, money_t cents) {
+    unsigned long long magnitude = cents < 0 ? 0ULL - (unsigned long long)cents : (unsigned long long)cents;
+    size_t length = 0;
+
+    if (cents < 0) {
+        dest[length++] = '-';
+    }
+    length += formatUnsigned(dest + length, magnitude / MONEY_SCALE);
+    dest[length++] = '.';
+    dest[length++] = (char)('0' + magnitude % MONEY_SCALE / 10);
+    dest[length++] = (char)('0' + magnitude % 10);
+    return length;
+}
+
+// Export: text padded with spaces to width, like %-*s (or %*s)
+size_t formatPadded(char *dest, const char *text, size_t length, size_t width, int rightAlign) {
+    size_t pad = length < width ? width - length : 0;
+
+    if (rightAlign) {
+        memset(dest, ' ', pad);
+        memcpy(dest + pad, text, length);
+    } else {
+        memcpy(dest, text, length);
+        memset(dest + length, ' ', pad);
+    }
+    return length + pad;
+}
+
+// Export: a CSV field, quoted (with doubled quotes) only when it holds a
+// comma, quote or line break
+size_t formatCsvField(char *dest, const char *text, size_t length) {
+    size_t out = 0;
+    size_t i;
+
+    for (i = 0; i < length && text[i] != ',' && text[i] != '"' && text[i] != '\r' && text[i] != '\n'; i++);
+    if (i == length) {
+        memcpy(dest, text, length);
+        return length;
+    }
+    dest[out++] = '"';
+    for (i = 0; i < length; i++) {
+        if (text[i] == '"') dest[out++] = '"';
+        dest[out++] = text[i];
+    }
+    dest[out++] = '"';
+    return out;
+}
+
+// Export: length of a name field, which is not terminated when it is full
+size_t fieldLength(const char *text, size_t size) {
+    const char *end = memchr(text, '\0', size);
+
+    return end != NULL ? (size_t)(end - text) : size;
+}
+
+// Export: a JSON string literal
+size_t formatJsonString(char *dest, const char *text, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    size_t out = 0;
+
+    dest[out++] = '"';
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+
+        if (c == '"' || c == '\\') {
+            dest[out++] = '\\';
+            dest[out++] = (char)c;
+        } else if (c < 0x20 || c >= 0x80) {
+            // Bytes above ASCII too: names carry no encoding, and raw
+            // ones would make the line invalid UTF-8
+            memcpy(dest + out, "\\u00", 4);
+            dest[out + 4] = hex[c >> 4];
+            dest[out + 5] = hex[c & 15];
+            out += 6;
+        } else {
+            dest[out++] = (char)c;
+        }
+    }
+    dest[out++] = '"';
+    return out;
+}
+
+// Helper function: append to a growing text buffer
+int textAppend(struct textBuffer *text, const char *line, size_t length) {
+    if (text->length + length > text->capacity) {
+        size_t capacity = text->capacity ? text->capacity * 2 : 4096;
+        char *grown;
+
+        while (capacity < text->length + length) capacity *= 2;
+        if ((grown = realloc(text->data, capacity)) == NULL) {
+            return -1;
+        }
+        text->data = grown;
+        text->capacity = capacity;
+    }
+    memcpy(text->data + text->length, line, length);
+    text->length += length;
+    return 0;
+}
+
+// Helper function: append to a growing record array; sets its status to
+// ACCOUNT_NO_MEMORY and returns -1 when memory runs out
+int recordAppend(struct recordArray *array, const struct clientData *client) {
+    if (array->count == array->capacity) {
+        size_t capacity = array->capacity ? array->capacity * 2 : 64;
+        struct clientData *grown = realloc(array->records, capacity * sizeof(*grown));
+
+        if (grown == NULL) {
+            array->status = ACCOUNT_NO_MEMORY;
+            return -1;
+        }
+        array->records = grown;
+        array->capacity = capacity;
+    }
+    array->records[array->count++] = *client;
+    return 0;
+}
+
+#ifdef HAVE_PTHREAD
+// Helper function: pthread_create with SIGINT and SIGTERM blocked in the
+// new thread, so they always reach the thread that waits for them (the
+// server's accept loop) rather than a worker
+int startThread(pthread_t *thread, void *(*start)(void *), void *arg) {
+    sigset_t blocked, previous;
+    int status;
+
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    status = pthread_create(thread, NULL, start, arg);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    return status;
+}
+#endif
+
+// Commit: start the flusher thread for a freshly opened store
+void commitStart(struct accountStore *store) {
+    struct commitPipeline *commits = &store->commits;
+
+    memset(commits, 0, sizeof(*commits));
+    if (commitEvery == 0) {
+        return;
+    }
+    commits->running = 1;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&commits->lock, NULL);
+    pthread_cond_init(&commits->wake, NULL);
+    pthread_cond_init(&commits->synced, NULL);
+    if (startThread(&commits->flusher, commitFlusher, store) != 0) {
+        // Without the thread, waiters sync for themselves
+        pthread_mutex_destroy(&commits->lock);
+        pthread_cond_destroy(&commits->wake);
+        pthread_cond_destroy(&commits->synced);
+        commits->running = -1;
+    }
+#else
+    commits->running = -1;
+#endif
+}
+
+// Commit: make everything queued durable and stop the flusher
+void commitStop(struct accountStore *store) {
+    struct commitPipeline *commits = &store->commits;
+
+    if (commits->running == 0) {
+        return;
+    }
+    commitFlush(store);
+#ifdef HAVE_PTHREAD
+    if (commits->running == 1) {
+        pthread_mutex_lock(&commits->lock);
+        commits->running = 0;
+        pthread_cond_signal(&commits->wake);
+        pthread_mutex_unlock(&commits->lock);
+        pthread_join(commits->flusher, NULL);
+        pthread_mutex_destroy(&commits->lock);
+        pthread_cond_destroy(&commits->wake);
+        pthread_cond_destroy(&commits->synced);
+    }
+#endif
+    commits->running = 0;
+    free(commits->waiting);
+    commits->waiting = NULL;
+}
+
+// Commit: queue a transaction whose record and ledger entry are written.
+// Returns its ticket for commitWait (0 when fsync is disabled).
+unsigned long long commitEnqueue(struct accountStore *store) {
+    struct commitPipeline *commits = &store->commits;
+    unsigned long long ticket;
+    int full;
+
+    if (commits->running == 0) {
+        return 0;
+    }
+#ifdef HAVE_PTHREAD
+    if (commits->running == 1) pthread_mutex_lock(&commits->lock);
+#endif
+    if (commits->waitingCount == commits->waitingCapacity) {
+        size_t capacity = commits->waitingCapacity ? commits->waitingCapacity * 2 : 256;
+        long long *grown = realloc(commits->waiting, capacity * sizeof(long long));
+
+        if (grown != NULL) {
+            commits->waiting = grown;
+            commits->waitingCapacity = capacity;
+        }
+    }
+    if (commits->waitingCount < commits->waitingCapacity) {
+        commits->waiting[commits->waitingCount++] = currentTimestamp();
+    }
+    ticket = ++commits->enqueued;
+    // Out of memory for the queue also forces a sync, which empties it
+    full = commits->waitingCount == 0 || commits->waitingCount >= commitEvery ||
+           currentTimestamp() - commits->waiting[0] >= commitMicros;
+#ifdef HAVE_PTHREAD
+    if (commits->running == 1) {
+        // Wake the flusher to start the batch timer, or to sync a full batch
+        if (full || ticket == commits->durable + 1) pthread_cond_signal(&commits->wake);
+        pthread_mutex_unlock(&commits->lock);
+        return ticket;
+    }
+#endif
+    // No flusher thread: the batch is synced by whoever fills it
+    if (full) {
+        commitFlush(store);
+    }
+    return ticket;
+}
+
+// Commit: block until the fsync covering ticket has completed
+void commitWait(struct accountStore *store, unsigned long long ticket) {
+    struct commitPipeline *commits = &store->commits;
+
+    if (ticket == 0) {
+        return;
+    }
+#ifdef HAVE_PTHREAD
+    if (commits->running == 1) {
+        int alone;
+
+        pthread_mutex_lock(&commits->lock);
+        // The only unsynced ticket, and nobody else waiting: no other
+        // writer can join the batch, so sync it without the timer
+        alone = commits->waiters == 0 && ticket == commits->enqueued && ticket == commits->durable + 1;
+        commits->waiters++;
+        if (alone) {
+            commits->flushRequests++;
+            pthread_cond_signal(&commits->wake);
+        }
+        while (commits->durable < ticket) {
+            pthread_cond_wait(&commits->synced, &commits->lock);
+        }
+        if (alone) {
+            commits->flushRequests--;
+        }
+        commits->waiters--;
+        pthread_mutex_unlock(&commits->lock);
+        return;
+    }
+#endif
+    if (commits->durable < ticket) {
+        commitFlush(store);
+    }
+}
+
+// Commit: sync everything queued so far without waiting for the batch to fill
+void commitFlush(struct accountStore *store) {
+    struct commitPipeline *commits = &store->commits;
+
+    if (commits->running == 0) {
+        return;
+    }
+#ifdef HAVE_PTHREAD
+    if (commits->running == 1) {
+        unsigned long long ticket;
+
+        pthread_mutex_lock(&commits->lock);
+        ticket = commits->enqueued;
+        commits->flushRequests++;   // the flusher skips its timer
+        pthread_cond_signal(&commits->wake);
+        while (commits->durable < ticket) {
+            pthread_cond_wait(&commits->synced, &commits->lock);
+        }
+        commits->flushRequests--;
+        pthread_mutex_unlock(&commits->lock);
+        return;
+    }
+#endif
+    if (commits->durable < commits->enqueued) {
+        commitBatch(store, commits->waiting, commits->waitingCount);
+        commits->waitingCount = 0;
+        commits->durable = commits->enqueued;
+    }
+}
+
+// Commit: one group commit. The ledger goes first, since records point
+// into it, then clients.dat; times are the batch's enqueue times.
+void commitBatch(struct accountStore *store, long long *times, size_t count) {
+    struct commitPipeline *commits = &store->commits;
+    long long now, started = metricsNow();
+
+    storeSync(store);
+    if (store->ledgerPtr != NULL) {
+        fsync(fileno(store->ledgerPtr));
+    }
+    if (store->fp != NULL) {
+        fsync(fileno(store->fp));
+    }
+    metricsRecord(METRIC_FSYNC, metricsNow() - started, 0, 0);
+    now = currentTimestamp();
+
+    commits->batches++;
+    commits->batchSize[log2Bucket(count)]++;
+    for (size_t i = 0; i < count; i++) {
+        commits->latency[log2Bucket((unsigned long long)(now > times[i] ? now - times[i] : 0))]++;
+    }
+}
+
+#ifdef HAVE_PTHREAD
+// Commit: flusher thread. Sleeps until a batch fills, its oldest entry
+// reaches commitMicros, or a flush is requested, then syncs the batch
+// with the lock released so new transactions keep queueing meanwhile.
+void *commitFlusher(void *arg) {
+    struct accountStore *store = arg;
+    struct commitPipeline *commits = &store->commits;
+    long long *batch = NULL;
+    size_t batchCapacity = 0;
+
+    pthread_mutex_lock(&commits->lock);
+    while (commits->running != 0 || commits->durable < commits->enqueued) {
+        unsigned long long ticket;
+        long long *swap;
+        size_t swapCapacity, count;
+
+        if (commits->durable == commits->enqueued) {
+            pthread_cond_wait(&commits->wake, &commits->lock);
+            continue;
+        }
+        if (commits->running == 1 && commits->flushRequests == 0 && commits->waitingCount > 0 &&
+            commits->waitingCount < commitEvery) {
+            long long deadline = commits->waiting[0] + commitMicros;
+
+            if (currentTimestamp() < deadline) {
+                struct timespec until;
+
+                until.tv_sec = (time_t)(deadline / 1000000);
+                until.tv_nsec = (long)(deadline % 1000000) * 1000;
+                pthread_cond_timedwait(&commits->wake, &commits->lock, &until);
+                continue;
+            }
+        }
+
+        // Take the batch; the spare array becomes the new queue
+        swap = commits->waiting;
+        swapCapacity = commits->waitingCapacity;
+        count = commits->waitingCount;
+        ticket = commits->enqueued;
+        commits->waiting = batch;
+        commits->waitingCapacity = batchCapacity;
+        commits->waitingCount = 0;
+        batch = swap;
+        batchCapacity = swapCapacity;
+        pthread_mutex_unlock(&commits->lock);
+
+        commitBatch(store, batch, count);
+
+        pthread_mutex_lock(&commits->lock);
+        commits->durable = ticket;
+        pthread_cond_broadcast(&commits->synced);
+    }
+    pthread_mutex_unlock(&commits->lock);
+    free(batch);
+    return NULL;
+}
+#endif
+
+// Commit: print the batch size and latency histograms
+void commitReport(struct accountStore *store) {
+    struct commitPipeline *commits = &store->commits;
+    unsigned long long total = 0;
+
+#ifdef HAVE_PTHREAD
+    if (commits->running == 1) pthread_mutex_lock(&commits->lock);
+#endif
+    for (int i = 0; i < COMMIT_BUCKETS; i++) {
+        total += commits->latency[i];
+    }
+    if (commitEvery == 0) {
+        puts("Group commit: fsync disabled (--sync-every 0).");
+    } else if (commits->batches > 0) {
+        printf("Group commit: %llu transactions in %llu fsyncs (%.1f per fsync; every %u or %lld us)\n",
+               total, commits->batches, (double)total / commits->batches, commitEvery, commitMicros);
+        puts("  Batch size       Fsyncs      Latency (us)         Transactions");
+        for (int i = 0; i < COMMIT_BUCKETS; i++) {
+            if (commits->batchSize[i] == 0 && commits->latency[i] == 0) continue;
+            printf("  %5llu-%-7llu %9llu      %7llu-%-10llu %12llu\n",
+                   i ? 1ULL << i : 0, (1ULL << (i + 1)) - 1, commits->batchSize[i],
+                   i ? 1ULL << i : 0, (1ULL << (i + 1)) - 1, commits->latency[i]);
+        }
+    }
+#ifdef HAVE_PTHREAD
+    if (commits->running == 1) pthread_mutex_unlock(&commits->lock);
+#endif
+}
+
+// Helper function: histogram bucket of a value, floor(log2), capped
+unsigned int log2Bucket(unsigned long long value) {
+    unsigned int bucket = 0;
+
+    while (value > 1 && bucket < COMMIT_BUCKETS - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Name index: open the trigram index stored next to clients.dat, or
+// rebuild it when it is missing or does not match the account file. It
+// matches only if it was last written by the session before this one: any
+// session in between (--serve, --apply) changed the accounts without it.
+void nameIndexOpen(struct accountStore *store) {
+    struct nameIndex *index = &store->names;
+    struct nameIndexHeader header;
+    struct nameIndexDelta delta;
+    FILE *indexPtr;
+    int valid = 0;
+
+    nameIndexClear(index);
+    index->fileName = store->indexName;
+    index->generation = store->header.generation;
+    if ((indexPtr = fopen(index->fileName, "rb")) != NULL) {
+        if (fread(&header, sizeof(header), 1, indexPtr) == 1 &&
+            header.magic == NAME_INDEX_MAGIC && header.version == NAME_INDEX_VERSION &&
+            header.generation == store->openGeneration) {
+            valid = 1;
+            index->accountCount = header.accountCount;
+            for (unsigned int i = 0; i < header.trigramCount && valid; i++) {
+                unsigned int entry[2];  // trigram, posting count
+                struct postingList *list;
+
+                if (fread(entry, sizeof(entry), 1, indexPtr) != 1 ||
+                    (list = postingListFor(index, entry[0], 1)) == NULL ||
+                    (list->accounts = malloc((entry[1] ? entry[1] : 1) * sizeof(unsigned int))) == NULL ||
+                    fread(list->accounts, sizeof(unsigned int), entry[1], indexPtr) != entry[1]) {
+                    valid = 0;
+                    break;
+                }
+                list->count = list->capacity = entry[1];
+            }
+            // Replay changes appended since the snapshot was written
+            while (valid && fread(&delta, sizeof(delta), 1, indexPtr) == 1) {
+                struct clientData names = {0, "", "", 0, LEDGER_NONE, 0};
+
+                names.acctNum = delta.acctNum;
+                memcpy(names.lastName, delta.lastName, LAST_NAME_LEN);
+                memcpy(names.firstName, delta.firstName, FIRST_NAME_LEN);
+                if (delta.op == NAME_INDEX_ADD) {
+                    nameIndexUpdate(index, &names, 1);
+                } else {
+                    nameIndexUpdate(index, &names, 0);
+                }
+                index->pendingDeltas++;
+            }
+        }
+        fclose(indexPtr);
+    }
+
+    if (!valid || index->accountCount != storeAccountCount(store)) {
+        puts("Building name index...");
+        nameIndexRebuild(store);
+        return;
+    }
+
+    // Claim the snapshot for this session, so it is still valid next time
+    // even if nothing changes
+    header.generation = index->generation;
+    if ((indexPtr = fopen(index->fileName, "rb+")) != NULL) {
+        fwrite(&header, sizeof(header), 1, indexPtr);
+        fclose(indexPtr);
+    }
+    index->logPtr = fopen(index->fileName, "ab");
+    index->loaded = 1;
+}
+
+// Name index: drop the in-memory index and scan clients.dat to recreate
+// it, then write a fresh snapshot. Also available offline (--rebuild-index).
+void nameIndexRebuild(struct accountStore *store) {
+    struct nameIndex *index = &store->names;
+    struct clientData buffer;
+    struct clientData *client;
+    unsigned int account = 0;
+
+    nameIndexClear(index);
+    index->fileName = store->indexName;
+    index->generation = store->header.generation;
+    while ((client = nextRecord(store, &account, &buffer)) != NULL) {
+        nameIndexUpdate(index, client, 1);
+    }
+    index->loaded = 1;
+    nameIndexSave(index);
+}
+
+// Name index: record an added or deleted account, in memory and in the
+// change log appended to clients.idx
+void nameIndexRecord(struct accountStore *store, const struct clientData *client, int adding) {
+    struct nameIndex *index = &store->names;
+    struct nameIndexDelta delta;
+
+    if (!index->loaded) {
+        return;
+    }
+    nameIndexUpdate(index, client, adding);
+
+    memset(&delta, 0, sizeof(delta));
+    delta.op = adding ? NAME_INDEX_ADD : NAME_INDEX_REMOVE;
+    delta.acctNum = client->acctNum;
+    memcpy(delta.lastName, client->lastName, LAST_NAME_LEN);
+    memcpy(delta.firstName, client->firstName, FIRST_NAME_LEN);
+    if (index->logPtr != NULL) {
+        fwrite(&delta, sizeof(delta), 1, index->logPtr);
+        fflush(index->logPtr);
+    }
+
+    // Fold a long change log back into a snapshot
+    if (++index->pendingDeltas >= NAME_INDEX_COMPACT_EVERY) {
+        nameIndexSave(index);
+    }
+}
+
+// Name index: accounts whose names contain every trigram of term (already
+// lowercased, at least 3 characters). Returns a malloc'd ascending array
+// the caller frees; *count is 0 if nothing can match.
+unsigned int *nameIndexCandidates(struct nameIndex *index, const char *term, size_t *count) {
+    struct postingList *lists[20];
+    size_t listCount = 0, len = strlen(term);
+    unsigned int *result;
+    size_t resultCount;
+
+    *count = 0;
+    for (size_t i = 0; i + 3 <= len; i++) {
+        struct postingList *list = postingListFor(index, trigramKey(term + i), 0);
+        if (list == NULL || list->count == 0) {
+            return NULL;
+        }
+        lists[listCount++] = list;
+    }
+
+    // Start from the shortest list and intersect the others into it
+    for (size_t i = 1; i < listCount; i++) {
+        if (lists[i]->count < lists[0]->count) {
+            struct postingList *t = lists[0];
+            lists[0] = lists[i];
+            lists[i] = t;
+        }
+    }
+    if ((result = malloc(lists[0]->count * sizeof(unsigned int))) == NULL) {
+        return NULL;
+    }
+    memcpy(result, lists[0]->accounts, lists[0]->count * sizeof(unsigned int));
+    resultCount = lists[0]->count;
+
+    for (size_t i = 1; i < listCount && resultCount > 0; i++) {
+        size_t kept = 0;
+        for (size_t j = 0; j < resultCount; j++) {
+            if (postingFind(lists[i], result[j], NULL)) {
+                result[kept++] = result[j];
+            }
+        }
+        resultCount = kept;
+    }
+
+    *count = resultCount;
+    return result;
+}
+
+// Name index: write a snapshot of every posting list (via a temp file) and
+// start an empty change log after it
+void nameIndexSave(struct nameIndex *index) {
+    struct nameIndexHeader header = {NAME_INDEX_MAGIC, NAME_INDEX_VERSION, 0, 0, index->generation, {0}};
+    char tempName[FILENAME_MAX + 8];
+    FILE *indexPtr;
+
+    snprintf(tempName, sizeof(tempName), "%s.tmp", index->fileName);
+    if (index->logPtr != NULL) {
+        fclose(index->logPtr);
+        index->logPtr = NULL;
+    }
+    if ((indexPtr = fopen(tempName, "wb")) == NULL) {
+        puts("Warning: Could not write name index.");
+        return;
+    }
+
+    for (size_t i = 0; i < index->tableSize; i++) {
+        if (index->lists[i].trigram != 0 && index->lists[i].count > 0) header.trigramCount++;
+    }
+    header.accountCount = index->accountCount;
+    fwrite(&header, sizeof(header), 1, indexPtr);
+    for (size_t i = 0; i < index->tableSize; i++) {
+        struct postingList *list = &index->lists[i];
+        if (list->trigram != 0 && list->count > 0) {
+            unsigned int entry[2] = {list->trigram, list->count};
+            fwrite(entry, sizeof(entry), 1, indexPtr);
+            fwrite(list->accounts, sizeof(unsigned int), list->count, indexPtr);
+        }
+    }
+    fclose(indexPtr);
+
+#ifdef _WIN32
+    remove(index->fileName);
+#endif
+    rename(tempName, index->fileName);
+    index->pendingDeltas = 0;
+    index->logPtr = fopen(index->fileName, "ab");
+}
+
+// Name index: release memory and close the change log
+void nameIndexClose(struct nameIndex *index) {
+    if (index->loaded && index->pendingDeltas > 0) {
+        nameIndexSave(index);
+    }
+    nameIndexClear(index);
+}
+
+// Helper function: empty the index (frees every posting list)
+void nameIndexClear(struct nameIndex *index) {
+    if (index->logPtr != NULL) {
+        fclose(index->logPtr);
+    }
+    for (size_t i = 0; i < index->tableSize; i++) {
+        free(index->lists[i].accounts);
+    }
+    free(index->lists);
+    memset(index, 0, sizeof(*index));
+}
+
+// Helper function: add or remove one account's trigrams
+void nameIndexUpdate(struct nameIndex *index, const struct clientData *client, int adding) {
+    char names[2][LAST_NAME_LEN];
+
+    lowercaseCopy(names[0], client->lastName, LAST_NAME_LEN);
+    lowercaseCopy(names[1], client->firstName, FIRST_NAME_LEN);
+
+    for (int n = 0; n < 2; n++) {
+        size_t len = strlen(names[n]);
+        for (size_t i = 0; i + 3 <= len; i++) {
+            struct postingList *list = postingListFor(index, trigramKey(names[n] + i), adding);
+            size_t pos;
+
+            if (list == NULL) continue;
+            if (postingFind(list, client->acctNum, &pos)) {
+                if (!adding) {
+                    memmove(&list->accounts[pos], &list->accounts[pos + 1],
+                            (list->count - pos - 1) * sizeof(unsigned int));
+                    list->count--;
+                }
+            } else if (adding) {
+                if (list->count == list->capacity) {
+                    unsigned int newCapacity = list->capacity ? list->capacity * 2 : 4;
+                    unsigned int *grown = realloc(list->accounts, newCapacity * sizeof(unsigned int));
+                    if (grown == NULL) continue;
+                    list->accounts = grown;
+                    list->capacity = newCapacity;
+                }
+                memmove(&list->accounts[pos + 1], &list->accounts[pos],
+                        (list->count - pos) * sizeof(unsigned int));
+                list->accounts[pos] = client->acctNum;
+                list->count++;
+            }
+        }
+    }
+
+    if (adding) {
+        index->accountCount++;
+    } else if (index->accountCount > 0) {
+        index->accountCount--;
+    }
+}
+
+// Helper function: find the posting list for a trigram, optionally creating
+// it (open addressing, the table doubles past 1/2 full)
+struct postingList *postingListFor(struct nameIndex *index, unsigned int trigram, int create) {
+    size_t slot;
+
+    if (create && (index->used + 1) * 2 > index->tableSize) {
+        size_t newSize = index->tableSize ? index->tableSize * 2 : 1024;
+        struct postingList *table = calloc(newSize, sizeof(struct postingList));
+
+        if (table == NULL) {
+            return NULL;
+        }
+        for (size_t i = 0; i < index->tableSize; i++) {
+            if (index->lists[i].trigram == 0) continue;
+            slot = (index->lists[i].trigram * 2654435761u) & (newSize - 1);
+            while (table[slot].trigram != 0) slot = (slot + 1) & (newSize - 1);
+            table[slot] = index->lists[i];
+        }
+        free(index->lists);
+        index->lists = table;
+        index->tableSize = newSize;
+    }
+    if (index->tableSize == 0) {
+        return NULL;
+    }
+
+    slot = (trigram * 2654435761u) & (index->tableSize - 1);
+    while (index->lists[slot].trigram != 0) {
+        if (index->lists[slot].trigram == trigram) {
+            return &index->lists[slot];
+        }
+        slot = (slot + 1) & (index->tableSize - 1);
+    }
+    if (!create) {
+        return NULL;
+    }
+    index->lists[slot].trigram = trigram;
+    index->used++;
+    return &index->lists[slot];
+}
+
+// Helper function: binary search a posting list; *pos receives the match
+// or the insertion point
+int postingFind(const struct postingList *list, unsigned int account, size_t *pos) {
+    size_t lo = 0, hi = list->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (list->accounts[mid] < account) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (pos != NULL) *pos = lo;
+    return lo < list->count && list->accounts[lo] == account;
+}
+
+// Helper function: pack three characters into a trigram key (never 0)
+unsigned int trigramKey(const char *text) {
+    return ((unsigned int)(unsigned char)text[0] << 16) |
+           ((unsigned int)(unsigned char)text[1] << 8) |
+           (unsigned int)(unsigned char)text[2];
+}
+
+// Helper function: copy a name, converting A-Z to lowercase
+void lowercaseCopy(char *dest, const char *src, size_t size) {
+    size_t i;
+
+    for (i = 0; i + 1 < size && src[i]; i++) {
+        dest[i] = (src[i] >= 'A' && src[i] <= 'Z') ? src[i] + 32 : src[i];
+    }
+    dest[i] = '\0';
+}
+
+// Helper function: case-insensitive substring match on either name;
+// term must already be lowercase
+int nameMatches(const struct clientData *client, const char *term) {
+    char tempLast[LAST_NAME_LEN], tempFirst[FIRST_NAME_LEN];
+
+    lowercaseCopy(tempLast, client->lastName, LAST_NAME_LEN);
+    lowercaseCopy(tempFirst, client->firstName, FIRST_NAME_LEN);
+    return strstr(tempLast, term) != NULL || strstr(tempFirst, term) != NULL;
+}
+
+// Batch mode: apply a file of "account,amount" lines.
+// Entries are grouped by account so each record is read and written once,
+// no matter how many transactions touch it.
+int applyTransactionFile(struct accountStore *store, const char *fileName) {
+    FILE *txnPtr;
+    char line[256];
+    struct pendingTxn *txns = NULL;
+    size_t count = 0, capacity = 0;
+    unsigned long lineNo = 0, malformed = 0, rejected = 0;
+    unsigned long applied = 0, accountsTouched = 0, appliedBefore = 0;
+    long long started;
+
+    if ((txnPtr = fopen(fileName, "r")) == NULL) {
+        printf("Error: Could not open %s\n", fileName);
+        return EXIT_FAILURE;
+    }
+
+    started = metricsNow();
+
+    while (fgets(line, sizeof(line), txnPtr) != NULL) {
+        char *p = line, *end;
+        unsigned long account;
+        money_t amount;
+
+        lineNo++;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0' || *p == '\n' || *p == '\r' || *p == '#') continue;
+
+        account = strtoul(p, &end, 10);
+        if (end == p || *end != ',') {
+            if (lineNo == 1) continue; // tolerate a header row
+            malformed++;
+            continue;
+        }
+        p = end + 1;
+        if (moneyFromDouble(strtod(p, &end), &amount) != 0 || end == p) {
+            malformed++;
+            continue;
+        }
+
+        if (account < 1 || account > MAX_ACCOUNT_NUMBER) {
+            rejected++;
+            continue;
+        }
+
+        if (count == capacity) {
+            size_t newCapacity = capacity ? capacity * 2 : 1024;
+            struct pendingTxn *grown = realloc(txns, newCapacity * sizeof(struct pendingTxn));
+            if (grown == NULL) {
+                puts("Error: Out of memory while reading transactions.");
+                free(txns);
+                fclose(txnPtr);
+                return EXIT_FAILURE;
+            }
+            txns = grown;
+            capacity = newCapacity;
+        }
+        txns[count].acctNum = (unsigned int)account;
+        txns[count].seq = (unsigned int)count;
+        txns[count].amount = amount;
+        count++;
+    }
+    fclose(txnPtr);
+
+    qsort(txns, count, sizeof(struct pendingTxn), comparePendingTxn);
+
+    for (size_t i = 0; i < count; ) {
+        struct clientData buffer;
+        struct clientData *client;
+        unsigned int account = txns[i].acctNum;
+        size_t groupEnd = i;
+
+        while (groupEnd < count && txns[groupEnd].acctNum == account) groupEnd++;
+
+        client = fetchRecordForUpdate(store, account, &buffer);
+        if (client == NULL || client->acctNum == 0) {
+            rejected += groupEnd - i;
+            i = groupEnd;
+            continue;
+        }
+
+        for (; i < groupEnd; i++) {
+            if (moneyAdd(&client->balance, txns[i].amount) != 0) {
+                rejected++;
+                continue;
+            }
+            if (addTransaction(store, client, txns[i].amount, (txns[i].amount >= 0) ? TXN_DEPOSIT : TXN_WITHDRAW) != 0) {
+                puts("Warning: Could not write to the transaction ledger.");
+            }
+            applied++;
+        }
+
+        commitRecord(store, account, client);
+        accountsTouched++;
+
+        // Queued without waiting; the flusher groups them into fsyncs
+        for (size_t queued = applied - appliedBefore; queued > 0; queued--) {
+            commitEnqueue(store);
+        }
+        appliedBefore = applied;
+    }
+    commitFlush(store);
+    free(txns);
+
+    double seconds = elapsedSeconds(started);
+    printf("Applied %lu transactions to %lu accounts in %.3f s", applied, accountsTouched, seconds);
+    if (seconds > 0) {
+        printf(" (%.0f transactions/s)", applied / seconds);
+    }
+    printf("\n");
+    if (rejected > 0) printf("Rejected (unknown account or balance out of range): %lu\n", rejected);
+    if (malformed > 0) printf("Skipped malformed lines: %lu\n", malformed);
+    commitReport(store);
+
+    return EXIT_SUCCESS;
+}
+
+// Helper function: order batch entries by account, then by input position
+int comparePendingTxn(const void *a, const void *b) {
+    const struct pendingTxn *x = a, *y = b;
+
+    if (x->acctNum != y->acctNum) return (x->acctNum < y->acctNum) ? -1 : 1;
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+// Helper function: seconds since started (a metricsNow() reading), on the
+// same monotonic clock as the metrics
+double elapsedSeconds(long long started) {
+    return (double)(metricsNow() - started) / 1e9;
+}
+
+// Helper function: copy the rest of one file into another in large blocks.
+// Returns -1 if a read or write fails; the caller still closes both.
+int copyFileBlocks(FILE *from, FILE *to) {
+    static char block[1 << 16];
+    size_t n;
+
+    while ((n = fread(block, 1, sizeof(block), from)) > 0) {
+        if (fwrite(block, 1, n, to) != n) {
+            return -1;
+        }
+    }
+    return ferror(from) ? -1 : 0;
+}
+
+// Helper function: make a closed file's contents durable before it is
+// renamed over another
+int syncFileName(const char *name) {
+    FILE *fp = fopen(name, "rb+");
+    int failed;
+
+    if (fp == NULL) {
+        return -1;
+    }
+    failed = fsync(fileno(fp)) != 0;
+    return (fclose(fp) != 0 || failed) ? -1 : 0;
+}
+
+// Benchmark: create a store of config->accounts accounts in the current
+// directory, run the workload against it and report on stdout, ending with
+// one line of JSON. The store files are removed afterwards, so existing
+// ones are never touched.
+int runBenchmark(const struct benchConfig *config, int useMmap) {
+    static const char *storeExtensions[] = {
+        ".dat", LEDGER_EXTENSION, COLUMN_EXTENSION, NAME_INDEX_EXTENSION, BACKUP_STATE_EXTENSION
+    };
+    char storeFiles[sizeof(storeExtensions) / sizeof(storeExtensions[0])][FILENAME_MAX];
+    struct accountStore store;
+    struct zipfGenerator zipf;
+    long long started;
+    unsigned long long random = config->seed;
+    unsigned long stride;
+    unsigned int totalWeight = 0;
+    unsigned char *ops;
+    long long *latencies;
+    double populateSeconds, seconds;
+    FILE *existing;
+    int status = 0;
+
+    for (size_t i = 0; i < sizeof(storeFiles) / sizeof(storeFiles[0]); i++) {
+        companionName(storeFiles[i], sizeof(storeFiles[i]), "clients.dat", storeExtensions[i]);
+        if ((existing = fopen(storeFiles[i], "rb")) != NULL) {
+            fclose(existing);
+            printf("Error: %s exists; run --bench in a directory without account files.\n", storeFiles[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (int op = 0; op < BENCH_OPS; op++) {
+        totalWeight += config->mix[op];
+    }
+    ops = malloc(config->operations);
+    latencies = malloc(config->operations * sizeof(long long));
+    if (ops == NULL || latencies == NULL) {
+        puts("Error: Not enough memory for the benchmark.");
+        free(ops);
+        free(latencies);
+        return EXIT_FAILURE;
+    }
+    if (storeOpen(&store, storeFiles[0], useMmap) != 0) {
+        free(ops);
+        free(latencies);
+        return EXIT_FAILURE;
+    }
+
+    printf("Creating %lu accounts...\n", config->accounts);
+    started = metricsNow();
+    if (benchPopulate(&store, config) != 0) {
+        puts("Error: Could not create the benchmark accounts.");
+        status = EXIT_FAILURE;
+    }
+    populateSeconds = elapsedSeconds(started);
+
+    // Ranks are spread over the accounts by a stride coprime to their
+    // count, so the hottest accounts do not all share the first pages
+    zipfInit(&zipf, config->accounts, config->skew);
+    stride = (unsigned long)(2654435761ULL % config->accounts);
+    for (;;) {
+        unsigned long a = stride, b = config->accounts;
+
+        while (b != 0) {
+            unsigned long t = a % b;
+            a = b;
+            b = t;
+        }
+        if (a == 1 || config->accounts == 1) break;
+        stride++;
+    }
+
+    printf("Running %lu operations...\n", config->operations);
+    started = metricsNow();
+    for (unsigned long i = 0; i < config->operations && status == 0; i++) {
+        unsigned int pick = (unsigned int)(benchRandom(&random) % totalWeight);
+        unsigned long rank = zipfNext(&zipf, &random);
+        unsigned int account = (unsigned int)((rank - 1) * stride % config->accounts + 1);
+        int op = 0;
+
+        while (pick >= config->mix[op]) {
+            pick -= config->mix[op++];
+        }
+        ops[i] = (unsigned char)op;
+        if ((latencies[i] = benchOperation(&store, op, account, config, &random)) < 0) {
+            printf("Error: Benchmark operation on account #%u failed.\n", account);
+            status = EXIT_FAILURE;
+        }
+    }
+    commitFlush(&store);
+    seconds = elapsedSeconds(started);
+
+    if (status == 0) {
+        commitReport(&store);
+        benchReport(config, useMmap, populateSeconds, seconds, ops, latencies);
+    }
+    storeClose(&store);
+    for (size_t i = 0; i < sizeof(storeFiles) / sizeof(storeFiles[0]); i++) {
+        remove(storeFiles[i]);
+    }
+    free(ops);
+    free(latencies);
+    return status;
+}
+
+// Benchmark: add accounts 1..config->accounts with generated names and
+// balances, each with its opening ledger entry, then index the names
+int benchPopulate(struct accountStore *store, const struct benchConfig *config) {
+    static const char *firstNames[] = {
+        "Ann", "Ben", "Cara", "Dan", "Eve", "Finn", "Gina", "Hugo",
+        "Ida", "Jack", "Kim", "Liam", "Mia", "Noah", "Olga", "Paul"
+    };
+    unsigned long long random = config->seed ^ 0x9e3779b97f4a7c15ULL;
+
+    for (unsigned long account = 1; account <= config->accounts; account++) {
+        struct clientData client = {0, "", "", 0, LEDGER_NONE, 0};
+
+        client.acctNum = (unsigned int)account;
+        benchLastName(client.lastName, client.acctNum, config->seed);
+        strcpy(client.firstName, firstNames[benchRandom(&random) % 16]);
+        client.balance = (money_t)(benchRandom(&random) % 10000000);
+        if (client.balance > 0 && addTransaction(store, &client, client.balance, TXN_INITIAL) != 0) {
+            return -1;
+        }
+        if (insertRecord(store, &client) != 0) {
+            return -1;
+        }
+    }
+    storeSync(store);
+    nameIndexRebuild(store);
+    return 0;
+}
+
+// Benchmark: run one operation on account and return its latency in
+// nanoseconds, or -1 if it failed. Deposits and withdrawals wait for the
+// group commit, as they do from the menu.
+long long benchOperation(struct accountStore *store, int op, unsigned int account,
+                         const struct benchConfig *config, unsigned long long *random) {
+    struct clientData client;
+    struct clientData *matches = NULL;
+    struct balanceSummary summary;
+    long long started, nanos;
+    char term[LAST_NAME_LEN];
+    size_t found = 0;
+    money_t amount = (money_t)(benchRandom(random) % 10000) + 1;
+    money_t balance;
+    int status = ACCOUNT_OK;
+
+    if (op == BENCH_SEARCH) {
+        // The last name of an account, so the term always matches
+        benchLastName(term, account, config->seed);
+        lowercaseCopy(term, term, sizeof(term));
+    }
+
+    started = metricsNow();
+    switch (op) {
+        case BENCH_DEPOSIT:
+            status = accountPost(store, account, amount, &balance);
+            break;
+        case BENCH_WITHDRAW:
+            status = accountPost(store, account, -amount, &balance);
+            break;
+        case BENCH_LOOKUP:
+            status = accountGet(store, account, &client);
+            break;
+        case BENCH_SEARCH:
+            status = accountSearch(store, term, &matches, &found);
+            break;
+        default:
+            status = accountSummary(store, &summary);
+            break;
+    }
+    nanos = metricsNow() - started;
+    free(matches);
+    if (status != ACCOUNT_OK || (op == BENCH_SEARCH && found == 0)) {
+        return -1;
+    }
+    return nanos;
+}
+
+// Benchmark: the generated last name of an account, the same on every call
+void benchLastName(char *dest, unsigned int account, unsigned long long seed) {
+    static const char *lastNames[] = {
+        "Smith", "Jones", "Brown", "Davis", "Moore", "Clark", "Lewis", "Walker",
+        "Hall", "Young", "King", "Wright", "Green", "Baker", "Adams", "Nelson"
+    };
+    unsigned long long hash = seed + account;
+    size_t length;
+
+    hash = benchRandom(&hash);
+    strcpy(dest, lastNames[hash % 16]);
+    // Two more letters give 10816 distinct names, so searches stay selective
+    length = strlen(dest);
+    dest[length] = (char)('a' + (hash >> 8) % 26);
+    dest[length + 1] = (char)('a' + (hash >> 16) % 26);
+    dest[length + 2] = '\0';
+}
+
+// Benchmark: print the totals, then one JSON line with throughput and
+// latency percentiles per operation
+void benchReport(const struct benchConfig *config, int useMmap, double populateSeconds, double seconds,
+                 const unsigned char *ops, const long long *latencies) {
+    static const char *names[BENCH_OPS] = {"deposit", "withdraw", "lookup", "search", "summary"};
+    static const unsigned int permille[] = {500, 990, 999};
+    static const char *labels[] = {"p50_us", "p99_us", "p999_us"};
+    unsigned long done = config->operations;
+    long long *sorted = malloc(done * sizeof(long long));
+
+    printf("Ran %lu operations on %lu accounts in %.3f s (%.0f operations/s)\n",
+           done, config->accounts, seconds, seconds > 0 ? done / seconds : 0.0);
+    if (sorted == NULL) {
+        puts("Error: Not enough memory for the latency report.");
+        return;
+    }
+    printf("{\"accounts\":%lu,\"operations\":%lu,\"skew\":%g,\"seed\":%llu,\"mmap\":%s,"
+           "\"sync_every\":%u,\"sync_usec\":%lld,\"threads\":%u,"
+           "\"populate_seconds\":%.6f,\"seconds\":%.6f,\"ops_per_second\":%.1f,\"ops\":{",
+           config->accounts, done, config->skew, config->seed, useMmap ? "true" : "false",
+           commitEvery, commitMicros, scanThreadCount(),
+           populateSeconds, seconds, seconds > 0 ? done / seconds : 0.0);
+
+    for (int op = 0, first = 1; op < BENCH_OPS; op++) {
+        unsigned long count = 0;
+        long long total = 0;
+
+        if (config->mix[op] == 0) continue;
+        for (unsigned long i = 0; i < done; i++) {
+            if (ops[i] == op) {
+                total += latencies[i];
+                sorted[count++] = latencies[i];
+            }
+        }
+        qsort(sorted, count, sizeof(long long), compareLatency);
+
+        // Throughput of an operation counts only the time spent in it
+        printf("%s\"%s\":{\"count\":%lu,\"ops_per_second\":%.1f", first ? "" : ",", names[op], count,
+               total > 0 ? count / (total / 1e9) : 0.0);
+        for (int p = 0; p < 3; p++) {
+            // Nearest rank: the smallest latency at or above that share of the samples
+            unsigned long rank = (count * permille[p] + 999) / 1000;
+            printf(",\"%s\":%.3f", labels[p], count > 0 ? sorted[rank > 0 ? rank - 1 : 0] / 1e3 : 0.0);
+        }
+        printf(",\"max_us\":%.3f}", count > 0 ? sorted[count - 1] / 1e3 : 0.0);
+        first = 0;
+    }
+    printf("}}\n");
+    free(sorted);
+}
+
+// Benchmark: weights for --bench-mix, "deposit,withdraw,lookup,search,summary".
+// Returns -1 unless there are five and at least one is not zero.
+int parseBenchMix(const char *text, unsigned int *mix) {
+    unsigned int weights[BENCH_OPS];
+    unsigned long total = 0;
+    char *end;
+
+    for (int op = 0; op < BENCH_OPS; op++) {
+        unsigned long weight = strtoul(text, &end, 10);
+
+        if (end == text || weight > 1000000 || *end != (op == BENCH_OPS - 1 ? '\0' : ',')) {
+            return -1;
+        }
+        weights[op] = (unsigned int)weight;
+        total += weight;
+        text = end + 1;
+    }
+    if (total == 0) {
+        return -1;
+    }
+    memcpy(mix, weights, sizeof(weights));
+    return 0;
+}
+
+// Benchmark: next value of a splitmix64 generator
+unsigned long long benchRandom(unsigned long long *state) {
+    unsigned long long z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Benchmark: precompute the Zipf constants for ranks 1..n; theta is in [0, 1)
+void zipfInit(struct zipfGenerator *zipf, unsigned long n, double theta) {
+    double zeta2 = 1 + pow(0.5, theta);
+
+    zipf->n = n;
+    zipf->theta = theta;
+    zipf->alpha = 1 / (1 - theta);
+    zipf->zetan = 0;
+    for (unsigned long i = 1; i <= n; i++) {
+        zipf->zetan += pow((double)i, -theta);
+    }
+    zipf->eta = n > 2 ? (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zipf->zetan) : 0;
+}
+
+// Benchmark: draw a rank from 1 to n
+unsigned long zipfNext(const struct zipfGenerator *zipf, unsigned long long *random) {
+    double u = (benchRandom(random) >> 11) * (1.0 / 9007199254740992.0);  // [0, 1)
+    double uz = u * zipf->zetan;
+    unsigned long rank;
+
+    if (uz < 1 || zipf->n == 1) return 1;
+    if (uz < 1 + pow(0.5, zipf->theta)) return 2;
+    rank = 1 + (unsigned long)(zipf->n * pow(zipf->eta * u - zipf->eta + 1, zipf->alpha));
+    return rank > zipf->n ? zipf->n : rank;
+}
+
+// Helper function: qsort order for latencies
+int compareLatency(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Metrics: start the clock for uptime and, on POSIX systems, a thread
+// that writes a dump to stderr on every SIGUSR1. Call before any other
+// thread starts, so they all inherit SIGUSR1 blocked and it is only
+// delivered to that thread.
+void metricsStart(void) {
+    metricsStarted = metricsNow();
+#ifdef HAVE_PTHREAD
+    sigset_t signals;
+    pthread_t waiter;
+
+    pthread_key_create(&metricsKey, metricsRelease);
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    if (startThread(&waiter, metricsSignalWaiter, NULL) == 0) {
+        pthread_detach(waiter);
+    }
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+// Metrics: dump on each SIGUSR1 (kill -USR1 <pid>)
+void *metricsSignalWaiter(void *arg) {
+    sigset_t signals;
+    char text[METRICS_TEXT_MAX];
+    int signum;
+
+    (void)arg;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    while (sigwait(&signals, &signum) == 0) {
+        metricsFormat(text, sizeof(text));
+        fputs(text, stderr);
+        fflush(stderr);
+    }
+    return NULL;
+}
+
+// Metrics: a thread is exiting; its block goes to the next new thread
+void metricsRelease(void *block) {
+    pthread_mutex_lock(&metricsLock);
+    ((struct metricsBlock *)block)->inUse = 0;
+    pthread_mutex_unlock(&metricsLock);
+}
+#endif
+
+// Metrics: nanoseconds on the monotonic clock where there is one, so a
+// step of the wall clock cannot show up as a latency
+long long metricsNow(void) {
+    struct timespec now;
+
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+    timespec_get(&now, TIME_UTC);
+#endif
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Metrics: the calling thread's block, taken over or allocated on first
+// use. Only this step locks. NULL if out of memory (nothing is recorded).
+struct metricsBlock *metricsLocal(void) {
+#ifdef HAVE_PTHREAD
+    struct metricsBlock *block;
+
+    if (metricsMine != NULL) {
+        return metricsMine;
+    }
+    pthread_mutex_lock(&metricsLock);
+    for (block = metricsBlocks; block != NULL && block->inUse; block = block->next);
+    if (block == NULL && (block = calloc(1, sizeof(*block))) != NULL) {
+        block->next = metricsBlocks;
+        metricsBlocks = block;
+    }
+    if (block != NULL) {
+        block->inUse = 1;
+        metricsMine = block;
+        if (metricsStarted != 0) {
+            pthread_setspecific(metricsKey, block);
+        }
+    }
+    pthread_mutex_unlock(&metricsLock);
+    return block;
+#else
+    if (metricsBlocks == NULL) {
+        metricsBlocks = calloc(1, sizeof(*metricsBlocks));
+    }
+    return metricsBlocks;
+#endif
+}
+
+// Metrics: record one operation of nanos (METRIC_UNTIMED to only count it)
+// that moved bytes. Each field has one writer, so plain increments published
+// with relaxed stores are enough.
+void metricsRecord(int op, long long nanos, size_t bytes, int hit) {
+    struct metricsBlock *block = metricsLocal();
+    struct metricCounters *counters;
+
+    if (block == NULL) {
+        return;
+    }
+    counters = &block->ops[op];
+    METRIC_STORE(counters->count, counters->count + 1);
+    METRIC_STORE(counters->bytes, counters->bytes + bytes);
+    if (hit) {
+        METRIC_STORE(counters->hits, counters->hits + 1);
+    }
+    if (nanos != METRIC_UNTIMED) {
+        unsigned long long value = nanos > 0 ? (unsigned long long)nanos : 0;
+        unsigned int bucket = metricsBucket(value);
+
+        METRIC_STORE(counters->timed, counters->timed + 1);
+        METRIC_STORE(counters->totalNanos, counters->totalNanos + value);
+        METRIC_STORE(counters->buckets[bucket], counters->buckets[bucket] + 1);
+        if (value > counters->maxNanos) {
+            METRIC_STORE(counters->maxNanos, value);
+        }
+    }
+}
+
+// Metrics: histogram bucket of a latency
+unsigned int metricsBucket(unsigned long long nanos) {
+    unsigned int exponent;
+
+    if (nanos < METRIC_LINEAR) {
+        return (unsigned int)nanos;
+    }
+#if defined(__GNUC__)
+    exponent = 63 - (unsigned int)__builtin_clzll(nanos);
+#else
+    for (exponent = 4; nanos >> (exponent + 1) != 0; exponent++);
+#endif
+    return METRIC_LINEAR + (exponent - 4) * METRIC_SUB_BUCKETS +
+           (unsigned int)((nanos >> (exponent - 3)) & (METRIC_SUB_BUCKETS - 1));
+}
+
+// Metrics: largest latency that falls in bucket
+unsigned long long metricsBucketLimit(unsigned int bucket) {
+    unsigned int exponent, sub;
+
+    if (bucket < METRIC_LINEAR) {
+        return bucket;
+    }
+    exponent = (bucket - METRIC_LINEAR) / METRIC_SUB_BUCKETS + 4;
+    sub = (bucket - METRIC_LINEAR) % METRIC_SUB_BUCKETS;
+    return ((unsigned long long)(METRIC_SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+}
+
+// Metrics: add up every thread's block and write one JSON line with each
+// operation's count, bytes, hit rate (read and search), mean and
+// p50/p99/p99.9/max latency. Returns the length written.
+size_t metricsFormat(char *dest, size_t size) {
+    static const char *names[METRIC_OPS] = {
+        "read", "write", "seek", "fsync", "ledger", "lookup", "post", "search"
+    };
+    static const unsigned int permille[] = {500, 990, 999};
+    static const char *labels[] = {"p50_us", "p99_us", "p999_us"};
+    static struct metricCounters total[METRIC_OPS];  // callers are serialized below
+    size_t length;
+    struct metricsBlock *block;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&metricsLock);
+#endif
+    memset(total, 0, sizeof(total));
+    for (block = metricsBlocks; block != NULL; block = block->next) {
+        for (int op = 0; op < METRIC_OPS; op++) {
+            const struct metricCounters *from = &block->ops[op];
+            struct metricCounters *to = &total[op];
+            unsigned long long maxNanos = METRIC_LOAD(from->maxNanos);
+
+            to->count += METRIC_LOAD(from->count);
+            to->bytes += METRIC_LOAD(from->bytes);
+            to->hits += METRIC_LOAD(from->hits);
+            to->timed += METRIC_LOAD(from->timed);
+            to->totalNanos += METRIC_LOAD(from->totalNanos);
+            if (maxNanos > to->maxNanos) to->maxNanos = maxNanos;
+            for (int i = 0; i < METRIC_BUCKETS; i++) {
+                to->buckets[i] += METRIC_LOAD(from->buckets[i]);
+            }
+        }
+    }
+
+    length = (size_t)snprintf(dest, size, "{\"uptime_s\":%.3f,\"ops\":{",
+                              (metricsNow() - metricsStarted) / 1e9);
+    for (int op = 0; op < METRIC_OPS && length < size; op++) {
+        const struct metricCounters *counters = &total[op];
+
+        length += (size_t)snprintf(dest + length, size - length, "%s\"%s\":{\"count\":%llu,\"bytes\":%llu",
+                                   op == 0 ? "" : ",", names[op], counters->count, counters->bytes);
+        if ((op == METRIC_READ || op == METRIC_SEARCH) && length < size) {
+            length += (size_t)snprintf(dest + length, size - length, ",\"hit_rate\":%.4f",
+                                       counters->count > 0 ? (double)counters->hits / counters->count : 0.0);
+        }
+        if (counters->timed > 0 && length < size) {
+            length += (size_t)snprintf(dest + length, size - length, ",\"mean_us\":%.3f",
+                                       counters->totalNanos / 1e3 / counters->timed);
+            for (int p = 0; p < 3 && length < size; p++) {
+                // Nearest rank, reported as the top of its bucket (at most the max)
+                unsigned long long rank = (counters->timed * permille[p] + 999) / 1000;
+                unsigned long long seen = 0, limit;
+                unsigned int bucket = 0;
+
+                while (bucket < METRIC_BUCKETS - 1 && (seen += counters->buckets[bucket]) < rank) bucket++;
+                limit = metricsBucketLimit(bucket);
+                length += (size_t)snprintf(dest + length, size - length, ",\"%s\":%.3f", labels[p],
+                                           (limit < counters->maxNanos ? limit : counters->maxNanos) / 1e3);
+            }
+            if (length < size) {
+                length += (size_t)snprintf(dest + length, size - length, ",\"max_us\":%.3f",
+                                           counters->maxNanos / 1e3);
+            }
+        }
+        if (length < size) {
+            length += (size_t)snprintf(dest + length, size - length, "}");
+        }
+    }
+    if (length < size) {
+        length += (size_t)snprintf(dest + length, size - length, "}}\n");
+    }
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&metricsLock);
+#endif
+    return length < size ? length : size - 1;
+}
+
+#ifdef HAVE_UNIX_SOCKET
+// Server: accept connections on a Unix domain socket until SIGINT/SIGTERM.
+// Requests (one per line, replies "OK ..." or "ERR ..."):
+//   BALANCE <acct>
+//   DEPOSIT <acct> <amount>
+//   WITHDRAW <acct> <amount>
+//   TRANSFER <from> <to> <amount>
+//   BACKUP                  full backup on a background thread
+//   STATS                   metrics as one JSON line (as for SIGUSR1)
+//   QUIT
+int runServer(struct accountStore *store, const char *socketPath) {
+    static struct transactionServer server;
+    struct sockaddr_un address;
+    struct sigaction action;
+    int listenFd;
+
+    if (store->map == NULL) {
+        puts("Error: The server needs memory-mapped access to clients.dat.");
+        return EXIT_FAILURE;
+    }
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        puts("Error: Socket path is too long.");
+        return EXIT_FAILURE;
+    }
+
+    memset(&server, 0, sizeof(server));
+    server.store = store;
+    for (int i = 0; i < SERVER_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&server.stripes[i], NULL);
+    }
+    pthread_mutex_init(&server.ledgerLock, NULL);
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.idle, NULL);
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        server.clients[i] = -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    unlink(socketPath);   // left behind by a server that did not exit cleanly
+
+    if ((listenFd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listenFd, SOMAXCONN) != 0) {
+        printf("Error: Could not listen on %s: %s\n", socketPath, strerror(errno));
+        if (listenFd >= 0) close(listenFd);
+        return EXIT_FAILURE;
+    }
+
+    // No SA_RESTART, so a signal interrupts accept(). Every other thread
+    // (startThread) has the signals blocked so they are delivered to this one.
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopServer;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Serving clients.dat on %s (%lu accounts). Press Ctrl+C to stop.\n",
+           socketPath, storeAccountCount(store));
+    fflush(stdout);
+
+    while (!serverStopping) {
+        struct serverConnection *connection;
+        pthread_t thread;
+        int fd = accept(listenFd, NULL, NULL);
+        int slot = -1;
+
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            printf("Error: accept failed: %s\n", strerror(errno));
+            break;
+        }
+
+        pthread_mutex_lock(&server.lock);
+        for (int i = 0; i < SERVER_MAX_CLIENTS && slot < 0; i++) {
+            if (server.clients[i] < 0) slot = i;
+        }
+        if (slot >= 0) {
+            server.clients[slot] = fd;
+            server.active++;
+        }
+        pthread_mutex_unlock(&server.lock);
+
+        if (slot < 0 || (connection = malloc(sizeof(*connection))) == NULL) {
+            const char *busy = "ERR server busy\n";
+            send(fd, busy, strlen(busy), 0);
+            close(fd);
+            if (slot >= 0) {
+                pthread_mutex_lock(&server.lock);
+                server.clients[slot] = -1;
+                server.active--;
+                pthread_mutex_unlock(&server.lock);
+            }
+            continue;
+        }
+        connection->server = &server;
+        connection->fd = fd;
+        connection->slot = slot;
+
+        if (startThread(&thread, serveConnection, connection) == 0) {
+            pthread_detach(thread);
+        } else {
+            serveConnection(connection);   // cannot start a thread: serve inline
+        }
+    }
+
+    // Stop reading from every client and wait for in-flight requests
+    close(listenFd);
+    unlink(socketPath);
+    pthread_mutex_lock(&server.lock);
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (server.clients[i] >= 0) shutdown(server.clients[i], SHUT_RDWR);
+    }
+    while (server.active > 0) {
+        pthread_cond_wait(&server.idle, &server.lock);
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    printf("\nServer stopped after %lu requests.\n", server.requests);
+    commitFlush(store);
+    commitReport(store);
+    return EXIT_SUCCESS;
+}
+
+// Server: answer one client's requests until it disconnects or sends QUIT
+void *serveConnection(void *arg) {
+    struct serverConnection *connection = arg;
+    struct transactionServer *server = connection->server;
+    FILE *in = fdopen(connection->fd, "r");
+    char line[256];
+    char reply[SERVER_REPLY_MAX];
+    unsigned long requests = 0;
+
+    while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+        int quit = handleRequest(server, line, reply, sizeof(reply));
+
+        requests++;
+        if (send(connection->fd, reply, strlen(reply), 0) < 0 || quit) break;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server->clients[connection->slot] = -1;
+    server->requests += requests;
+    if (--server->active == 0) {
+        pthread_cond_signal(&server->idle);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (in != NULL) {
+        fclose(in);
+    } else {
+        close(connection->fd);
+    }
+    free(connection);
+    return NULL;
+}
+
+// Server: parse and run one request line, writing the reply line.
+// Returns 1 if the client asked to disconnect.
+int handleRequest(struct transactionServer *server, char *line, char *reply, size_t size) {
+    char command[16];
+    unsigned int account, target;
+    double input;
+    money_t amount, balance, targetBalance;
+    const char *error;
+    long long started;
+
+    if (sscanf(line, "%15s", command) != 1) {
+        snprintf(reply, size, "ERR empty request\n");
+        return 0;
+    }
+    for (int i = 0; command[i]; i++) {
+        if (command[i] >= 'a' && command[i] <= 'z') command[i] -= 32;
+    }
+
+    if (strcmp(command, "QUIT") == 0) {
+        snprintf(reply, size, "OK bye\n");
+        return 1;
+    }
+
+    if (strcmp(command, "BALANCE") == 0) {
+        struct clientData client;
+
+        if (sscanf(line, "%*s %u", &account) != 1) {
+            snprintf(reply, size, "ERR usage: BALANCE <acct>\n");
+            return 0;
+        }
+        pthread_mutex_lock(serverStripe(server, account));
+        if (accountGet(server->store, account, &client) != ACCOUNT_OK) {
+            snprintf(reply, size, "ERR account not found\n");
+        } else {
+            snprintf(reply, size, "OK %u %s %s %.2f\n", client.acctNum,
+                     client.lastName, client.firstName, moneyToDouble(client.balance));
+        }
+        pthread_mutex_unlock(serverStripe(server, account));
+        return 0;
+    }
+
+    if (strcmp(command, "DEPOSIT") == 0 || strcmp(command, "WITHDRAW") == 0) {
+        if (sscanf(line, "%*s %u %lf", &account, &input) != 2 ||
+            moneyFromDouble(input, &amount) != 0 || amount <= 0) {
+            snprintf(reply, size, "ERR usage: %s <acct> <positive amount>\n", command);
+            return 0;
+        }
+        if (command[0] == 'W') amount = -amount;
+        started = metricsNow();
+        if ((error = serverPost(server, account, amount, &balance)) != NULL) {
+            snprintf(reply, size, "ERR %s\n", error);
+        } else {
+            // Reply only once the change is durable; concurrent requests share the fsync
+            commitWait(server->store, commitEnqueue(server->store));
+            snprintf(reply, size, "OK %.2f\n", moneyToDouble(balance));
+            metricsRecord(METRIC_POST, metricsNow() - started, 0, 0);
+        }
+        return 0;
+    }
+
+    if (strcmp(command, "TRANSFER") == 0) {
+        if (sscanf(line, "%*s %u %u %lf", &account, &target, &input) != 3 ||
+            moneyFromDouble(input, &amount) != 0 || amount <= 0) {
+            snprintf(reply, size, "ERR usage: TRANSFER <from> <to> <positive amount>\n");
+            return 0;
+        }
+        if ((error = serverTransfer(server, account, target, amount, &balance, &targetBalance)) != NULL) {
+            snprintf(reply, size, "ERR %s\n", error);
+        } else {
+            commitWait(server->store, commitEnqueue(server->store));
+            snprintf(reply, size, "OK %.2f %.2f\n", moneyToDouble(balance), moneyToDouble(targetBalance));
+        }
+        return 0;
+    }
+
+    if (strcmp(command, "STATS") == 0 && size > 4) {
+        strcpy(reply, "OK ");
+        metricsFormat(reply + 3, size - 3);   // ends in a newline
+        return 0;
+    }
+
+    if (strcmp(command, "BACKUP") == 0) {
+        char backupName[BACKUP_NAME_LEN];
+        char ledgerName[BACKUP_NAME_LEN];
+
+        // With every stripe held no transaction is half done, so the backup
+        // starts from a consistent state; requests resume as soon as the
+        // thread is started
+        for (int i = 0; i < SERVER_LOCK_STRIPES; i++) {
+            pthread_mutex_lock(&server->stripes[i]);
+        }
+        pthread_mutex_lock(&server->ledgerLock);
+        onlineBackupFinish(server->store, 0);
+        backupFileName(backupName, sizeof(backupName), "clients_backup", "dat");
+        companionName(ledgerName, sizeof(ledgerName), backupName, LEDGER_EXTENSION);
+        if (server->store->online.active) {
+            snprintf(reply, size, "ERR a backup is still running\n");
+        } else if (onlineBackupStart(server->store, backupName, ledgerName) != 0) {
+            snprintf(reply, size, "ERR could not create %s\n", backupName);
+        } else {
+            snprintf(reply, size, "OK %s\n", backupName);
+        }
+        pthread_mutex_unlock(&server->ledgerLock);
+        for (int i = SERVER_LOCK_STRIPES - 1; i >= 0; i--) {
+            pthread_mutex_unlock(&server->stripes[i]);
+        }
+        return 0;
+    }
+
+    snprintf(reply, size, "ERR unknown command %s\n", command);
+    return 0;
+}
+
+// Server: deposit (amount > 0) or withdraw (amount < 0) under the page lock.
+// The ledger entry is flushed before the record that points to it changes.
+// Returns NULL on success or the reason for the refusal.
+const char *serverPost(struct transactionServer *server, unsigned int account, money_t amount, money_t *balance) {
+    pthread_mutex_t *stripe = serverStripe(server, account);
+    struct clientData buffer;
+    struct clientData *client;
+    struct clientData updated;
+    const char *error = NULL;
+
+    pthread_mutex_lock(stripe);
+    client = fetchRecord(server->store, account, &buffer);
+    if (client == NULL || client->acctNum == 0) {
+        error = "account not found";
+    } else {
+        updated = *client;
+        if (moneyAdd(&updated.balance, amount) != 0) {
+            error = "balance out of range";
+        } else {
+            pthread_mutex_lock(&server->ledgerLock);
+            if (addTransaction(server->store, &updated, amount, amount >= 0 ? TXN_DEPOSIT : TXN_WITHDRAW) != 0) {
+                puts("Warning: Could not write to the transaction ledger.");
+            }
+            fflush(server->store->ledgerPtr);
+            pthread_mutex_unlock(&server->ledgerLock);
+
+            commitRecord(server->store, account, &updated);
+            *balance = updated.balance;
+        }
+    }
+    pthread_mutex_unlock(stripe);
+    return error;
+}
+
+// Server: move amount between two accounts. Both page locks are taken in
+// stripe order (once if they share a stripe), so opposing transfers cannot
+// deadlock, and neither account changes unless both can.
+const char *serverTransfer(struct transactionServer *server, unsigned int from, unsigned int to,
+                           money_t amount, money_t *fromBalance, money_t *toBalance) {
+    pthread_mutex_t *first = serverStripe(server, from);
+    pthread_mutex_t *second = serverStripe(server, to);
+    struct clientData fromBuffer, toBuffer;
+    struct clientData *source, *target;
+    struct clientData updatedFrom, updatedTo;
+    const char *error = NULL;
+
+    if (from == to) {
+        return "cannot transfer to the same account";
+    }
+    if (first > second) {
+        pthread_mutex_t *swap = first;
+        first = second;
+        second = swap;
+    }
+    pthread_mutex_lock(first);
+    if (second != first) pthread_mutex_lock(second);
+
+    source = fetchRecord(server->store, from, &fromBuffer);
+    target = fetchRecord(server->store, to, &toBuffer);
+    if (source == NULL || source->acctNum == 0 || target == NULL || target->acctNum == 0) {
+        error = "account not found";
+    } else {
+        updatedFrom = *source;
+        updatedTo = *target;
+        if (moneyAdd(&updatedFrom.balance, -amount) != 0 || moneyAdd(&updatedTo.balance, amount) != 0) {
+            error = "balance out of range";
+        } else {
+            pthread_mutex_lock(&server->ledgerLock);
+            if (ledgerAppendTransfer(server->store, &updatedFrom, &updatedTo, amount) != 0) {
+                puts("Warning: Could not write to the transaction ledger.");
+            }
+            fflush(server->store->ledgerPtr);
+            pthread_mutex_unlock(&server->ledgerLock);
+
+            commitRecord(server->store, from, &updatedFrom);
+            commitRecord(server->store, to, &updatedTo);
+            *fromBalance = updatedFrom.balance;
+            *toBalance = updatedTo.balance;
+        }
+    }
+
+    if (second != first) pthread_mutex_unlock(second);
+    pthread_mutex_unlock(first);
+    return error;
+}
+
+// Server: the lock covering an account's logical page
+pthread_mutex_t *serverStripe(struct transactionServer *server, unsigned int account) {
+    unsigned int logicalPage = account > 0 ? (account - 1) / RECORDS_PER_PAGE : 0;
+
+    return &server->stripes[logicalPage % SERVER_LOCK_STRIPES];
+}
+
+// Server: SIGINT/SIGTERM handler, ends the accept loop
+void stopServer(int signum) {
+    (void)signum;
+    serverStopping = 1;
+}
+#endif